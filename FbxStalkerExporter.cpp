@@ -1,14 +1,52 @@
 #include <fbxsdk.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
 #include "xray_re/xr_envelope.h"
 #include "xray_re/xr_file_system.h"
 #include "xray_re/xr_ini_file.h"
 #include "xray_re/xr_level.h"
 #include "xray_re/xr_level_cform.h"
+#include "xray_re/xr_level_sectors.h"
 #include "xray_re/xr_level_shaders.h"
 #include "xray_re/xr_level_visuals.h"
 #include "xray_re/xr_ogf.h"
 #include "xray_re/xr_ogf_v4.h"
+#include "xray_re/xr_omf_cache.h"
+#include "xray_re/xr_parallel.h"
+#include "xray_re/xr_string_utils.h"
 
 namespace {
 
@@ -17,13 +55,54 @@ enum class FbxStalkerMotionsExportType
 	eWitoutMotions,
 	eWithInternalMotions,
 	eWithExternalMotions,
-	eExternalMotionsOnly
+	eExternalMotionsOnly,
+	eSplitMotions		// mesh once, then a file per motion
+};
+
+// Settings shared by every motion of a run.
+struct FbxStalkerMotionOptions
+{
+	xray_re::xr_motion_filter Filter;
+
+	// Key reduction drops keys that linear interpolation between the kept
+	// ones reproduces within the tolerance; otherwise every baked key is
+	// written as a cubic key.
+	bool ReduceKeys = false;
+	double TranslationTolerance = 0.0;	// metres
+	double RotationTolerance = 0.0;		// degrees
+
+	// Streaming holds one OMF at a time, loaded past the shared cache,
+	// and drops each motion's envelopes as soon as it is baked.
+	bool Streaming = false;
+};
+
+struct FbxStalkerLevelOptions
+{
+	// Merging bakes the level visuals into world space and writes one mesh
+	// per material rather than a node per visual. Merged meshes are split
+	// once they would exceed MaxMergedVertices (0 for no limit).
+	bool MergeByMaterial = false;
+	std::size_t MaxMergedVertices = 0;
+
+	// Tiling writes the level as one FBX per TileSize x TileSize cell of
+	// the XZ plane, or per level sector, plus <level>.tiles.ltx.
+	float TileSize = 0.f;			// metres
+	bool TileBySectors = false;
+
+	// SWI level of detail of progressive visuals, 0 being the finest.
+	unsigned SwiLod = 0;
+};
+
+struct FbxStalkerKeyStats
+{
+	std::size_t NumSourceKeys = 0;
+	std::size_t NumKeys = 0;
 };
 
 inline FbxString FbxStalkerGetBaseFilename(const char* Path)
 {
 	const FbxString FilePath = Path;
-	const int Pos = FilePath.ReverseFind('\\');
+	const int Pos = std::max(FilePath.ReverseFind('\\'), FilePath.ReverseFind('/'));
 
 	if (Pos != -1)
 	{
@@ -33,22 +112,21 @@ inline FbxString FbxStalkerGetBaseFilename(const char* Path)
 	return FilePath;
 }
 
-bool FbxStalkerExportStaticMesh(
-	const xray_re::xr_ogf* Ogf,
+// Fills Mesh with a triangle list. IndexBuffer is an xr_ibuf or any
+// other container of indices.
+template<typename IndexBufferType>
+bool FbxStalkerFillMesh(
+	const xray_re::fvector3* Vert,
+	const xray_re::fvector3* Norm,
+	const xray_re::fvector2* UV,
+	std::size_t VertexCount,
+	const IndexBufferType& IndexBuffer,
+	std::size_t IndexCount,
 	FbxMesh* Mesh)
 {
-	const auto& VertexBuffer = Ogf->vb();
-	const auto& IndexBuffer = Ogf->ib();
-
-	const int ChannelId = 0;
 	const int VertsPerFace = 3;
-	const int NumVerts = static_cast<int>(VertexBuffer.size());
-	const int NumFaces = static_cast<int>(IndexBuffer.size()) / VertsPerFace;
-	const int NumChannels = 1;
-
-	const auto* Vert = VertexBuffer.p();
-	const auto* Norm = VertexBuffer.n();
-	const auto* UV = VertexBuffer.tc();
+	const int NumVerts = static_cast<int>(VertexCount);
+	const int NumFaces = static_cast<int>(IndexCount) / VertsPerFace;
 
 	if (!Vert || !Norm || !UV || !NumFaces)
 	{
@@ -67,7 +145,14 @@ bool FbxStalkerExportStaticMesh(
 	LayerElementMaterial->SetMappingMode(FbxLayerElement::eByPolygon);
 	LayerElementMaterial->SetReferenceMode(FbxLayerElement::eIndexToDirect);
 
+	auto& NormalArray = GeometryElementNormal->GetDirectArray();
+	auto& UVArray = LayerElementDiffuseUV->GetDirectArray();
+	NormalArray.Resize(NumVerts);
+	UVArray.Resize(NumVerts);
+
 	FbxVector4* ControlPoints = Mesh->GetControlPoints();
+	FbxVector4* Normals = NormalArray.GetLocked(FbxLayerElementArray::eWriteLock);
+	FbxVector2* UVs = UVArray.GetLocked(FbxLayerElementArray::eWriteLock);
 	for (int VertId = 0; VertId < NumVerts; ++VertId)
 	{
 		ControlPoints[VertId].Set(
@@ -75,20 +160,18 @@ bool FbxStalkerExportStaticMesh(
 			Vert[VertId].y,
 			Vert[VertId].z
 		);
-		GeometryElementNormal->GetDirectArray().Add(
-			FbxVector4(
-				Norm[VertId].x,
-				Norm[VertId].y,
-				Norm[VertId].z
-			)
+		Normals[VertId].Set(
+			Norm[VertId].x,
+			Norm[VertId].y,
+			Norm[VertId].z
 		);
-		LayerElementDiffuseUV->GetDirectArray().Add(
-			FbxVector2(
-				UV[VertId].u,
-				UV[VertId].v
-			)
+		UVs[VertId].Set(
+			UV[VertId].u,
+			UV[VertId].v
 		);
 	}
+	UVArray.Release(&UVs);
+	NormalArray.Release(&Normals);
 
 	if (Mesh->GetLayerCount() == 0)
 	{
@@ -99,6 +182,8 @@ bool FbxStalkerExportStaticMesh(
 	Layer->SetUVs(LayerElementDiffuseUV, FbxLayerElement::eTextureDiffuse);
 	Layer->SetMaterials(LayerElementMaterial);
 
+	Mesh->ReservePolygonCount(NumFaces);
+	Mesh->ReservePolygonVertexCount(NumFaces * VertsPerFace);
 	for (int FaceId = 0; FaceId < NumFaces; ++FaceId)
 	{
 		Mesh->BeginPolygon(0);
@@ -113,6 +198,47 @@ bool FbxStalkerExportStaticMesh(
 	return true;
 }
 
+// Proxies the indices of a visual at SWI level of detail SwiLod (0 is the
+// finest, larger ones are clamped to the coarsest window) and returns how
+// many leading vertices of vb() they use. Only progressive visuals have
+// more than one level; their vertices are ordered so that coarser windows
+// use fewer of them.
+std::size_t FbxStalkerGetLodIndices(
+	const xray_re::xr_ogf* Ogf,
+	unsigned SwiLod,
+	xray_re::xr_ibuf& IndexBuffer)
+{
+	const auto* OgfV4 = dynamic_cast<const xray_re::xr_ogf_v4*>(Ogf);
+	if (SwiLod == 0 || OgfV4 == nullptr || !OgfV4->progressive() || OgfV4->swib().size() == 0)
+	{
+		IndexBuffer.proxy(Ogf->ib(), 0, Ogf->ib().size());
+		return Ogf->vb().size();
+	}
+
+	OgfV4->swi_ib(std::min<std::size_t>(SwiLod, OgfV4->swib().size() - 1), IndexBuffer);
+	std::size_t NumVerts = 0;
+	for (std::size_t IndexId = 0; IndexId < IndexBuffer.size(); ++IndexId)
+	{
+		NumVerts = std::max<std::size_t>(NumVerts, IndexBuffer[IndexId] + 1);
+	}
+	return NumVerts;
+}
+
+bool FbxStalkerExportStaticMesh(
+	const xray_re::xr_ogf* Ogf,
+	unsigned SwiLod,
+	FbxMesh* Mesh)
+{
+	const auto& VertexBuffer = Ogf->vb();
+
+	xray_re::xr_ibuf IndexBuffer;
+	const std::size_t NumVerts = FbxStalkerGetLodIndices(Ogf, SwiLod, IndexBuffer);
+
+	return FbxStalkerFillMesh(
+		VertexBuffer.p(), VertexBuffer.n(), VertexBuffer.tc(), NumVerts,
+		IndexBuffer, IndexBuffer.size(), Mesh);
+}
+
 FbxSurfaceMaterial* FbxStalkerExportMaterial(
 	const xray_re::xr_file_system& Filesystem,
 	const FbxString& MaterialPath,
@@ -157,6 +283,15 @@ FbxSurfaceMaterial* FbxStalkerExportMaterial(
 	return Material;
 }
 
+struct FbxStalkerBone
+{
+	FbxNode* Node = nullptr;
+	FbxCluster* Cluster = nullptr;
+};
+
+// Dense bone id to skeleton node/skin cluster map, filled once per skeleton
+using FbxStalkerBoneTable = std::vector<FbxStalkerBone>;
+
 FbxNode* FbxStalkerExportBone(
 	const xray_re::xr_bone* Bone,
 	FbxScene* Scene,
@@ -193,13 +328,28 @@ FbxNode* FbxStalkerExportBone(
 	return Node;
 }
 
+void FbxStalkerRegisterBone(
+	FbxNode* Node,
+	FbxStalkerBoneTable& BoneTable)
+{
+	const auto* Bone = static_cast<xray_re::xr_bone*>(
+		Node->GetUserDataPtr());
+	if (Bone && Bone->id() < BoneTable.size())
+	{
+		BoneTable[Bone->id()].Node = Node;
+	}
+}
+
 FbxNode* FbxStalkerExportSkeleton(
 	const xray_re::xr_bone_vec& Bones,
 	FbxScene* Scene,
+	FbxStalkerBoneTable& BoneTable,
 	FbxNode* Root = nullptr)
 {
 	if (Root == nullptr)
 	{
+		BoneTable.assign(Bones.size(), FbxStalkerBone());
+
 		for (const auto* Bone : Bones)
 		{
 			if (Bone->is_root())
@@ -212,8 +362,11 @@ FbxNode* FbxStalkerExportSkeleton(
 
 		if (Root == nullptr)
 		{
+			BoneTable.clear();
 			return Root;
 		}
+
+		FbxStalkerRegisterBone(Root, BoneTable);
 	}
 
 	const auto& Bone = static_cast<xray_re::xr_bone*>(
@@ -222,54 +375,59 @@ FbxNode* FbxStalkerExportSkeleton(
 	{
 		auto Node = FbxStalkerExportBone(
 			Child, Scene, FbxSkeleton::eLimbNode);
+		FbxStalkerRegisterBone(Node, BoneTable);
 		auto Skeleton = FbxStalkerExportSkeleton(
-			Bones, Scene, Node);
+			Bones, Scene, BoneTable, Node);
 		Root->AddChild(Skeleton);
 	}
 
 	return Root;
 }
 
-FbxNode* FbxStalkerGetBone(FbxNode* Skeleton, int BoneId)
+inline FbxNode* FbxStalkerGetBone(
+	const FbxStalkerBoneTable& BoneTable,
+	std::size_t BoneId)
 {
-	auto Bone = reinterpret_cast<xray_re::xr_bone*>(
-		Skeleton->GetUserDataPtr());
-	if (Bone && Bone->id() == BoneId)
-	{
-		return Skeleton;
-	}
+	return BoneId < BoneTable.size() ? BoneTable[BoneId].Node : nullptr;
+}
+
+inline FbxCluster* FbxStalkerGetCluster(
+	const FbxStalkerBoneTable& BoneTable,
+	std::size_t BoneId)
+{
+	return BoneId < BoneTable.size() ? BoneTable[BoneId].Cluster : nullptr;
+}
+
+void FbxStalkerInitClusters(
+	FbxStalkerBoneTable& BoneTable,
+	FbxSkin* Skin,
+	FbxScene* Scene)
+{
+	// Clusters are owned by the skin, so every skinned visual gets its own
+	// set which replaces the one left in the table by the previous visual
 
-	for (int ChildId = 0; ChildId < Skeleton->GetChildCount(); ++ChildId)
+	for (auto& Bone : BoneTable)
 	{
-		auto Child = Skeleton->GetChild(ChildId);
-		if (auto Bone = FbxStalkerGetBone(Child, BoneId))
+		Bone.Cluster = nullptr;
+		if (Bone.Node == nullptr)
 		{
-			return Bone;
+			continue;
 		}
-	}
-
-	return nullptr;
-}
 
-void FbxStalkerInitClusters(FbxNode* Skeleton, FbxSkin* Skin, FbxScene* Scene)
-{
-	auto Matrix = Skeleton->EvaluateGlobalTransform();
-	auto Cluster = FbxCluster::Create(Scene, "");
+		auto Matrix = Bone.Node->EvaluateGlobalTransform();
+		auto Cluster = FbxCluster::Create(Scene, "");
 
-	Cluster->SetLink(Skeleton);
-	Cluster->SetLinkMode(FbxCluster::eTotalOne);
-	Cluster->SetTransformLinkMatrix(Matrix);
-	Skin->AddCluster(Cluster);
+		Cluster->SetLink(Bone.Node);
+		Cluster->SetLinkMode(FbxCluster::eTotalOne);
+		Cluster->SetTransformLinkMatrix(Matrix);
+		Skin->AddCluster(Cluster);
 
-	for (int ChildId = 0; ChildId < Skeleton->GetChildCount(); ++ChildId)
-	{
-		auto Child = Skeleton->GetChild(ChildId);
-		FbxStalkerInitClusters(Child, Skin, Scene);
+		Bone.Cluster = Cluster;
 	}
 }
 
 void FbxStalkerCreateSkin(
-	FbxNode* Skeleton,
+	FbxStalkerBoneTable& BoneTable,
 	FbxNode* Visual,
 	FbxScene* Scene,
 	const xray_re::xr_vbuf& Verts)
@@ -285,7 +443,7 @@ void FbxStalkerCreateSkin(
 
 	auto Skin = FbxSkin::Create(Scene, "");
 	
-	FbxStalkerInitClusters(Skeleton, Skin, Scene);
+	FbxStalkerInitClusters(BoneTable, Skin, Scene);
 	for (int VertId = 0; VertId < Verts.size(); ++VertId)
 	{
 		const auto& Influences = Verts.w(VertId);
@@ -293,18 +451,8 @@ void FbxStalkerCreateSkin(
 		{
 			const auto& Influence = Influences[InfluenceId];
 
-			FbxNode* Bone = FbxStalkerGetBone(
-				Skeleton, Influence.bone);
-			if (Bone == nullptr)
-			{
-				FBXSDK_printf(
-					"Unexpected bone index #%d used while trying to export skin",
-					Influence.bone);
-				Skin->Destroy();
-				return;
-			}
-
-			FbxCluster* Cluster = Skin->GetCluster(Influence.bone);
+			FbxCluster* Cluster = FbxStalkerGetCluster(
+				BoneTable, Influence.bone);
 			if (Cluster == nullptr)
 			{
 				FBXSDK_printf(
@@ -330,7 +478,7 @@ FbxNode* FbxStalkerExportSkinnedVisual(
 	FbxNode* Node = FbxNode::Create(Scene, Name);
 	FbxMesh* Mesh = FbxMesh::Create(Scene, Name);
 
-	if (!FbxStalkerExportStaticMesh(Ogf, Mesh))
+	if (!FbxStalkerExportStaticMesh(Ogf, 0, Mesh))
 	{
 		Mesh->Destroy();
 		Node->Destroy();
@@ -359,7 +507,8 @@ FbxNode* FbxStalkerExportSkinnedVisual(
 void FbxStalkerExportSkinnedVisuals(
 	const xray_re::xr_file_system& Filesystem,
 	const xray_re::xr_ogf* Ogf,
-	FbxScene* Scene)
+	FbxScene* Scene,
+	FbxStalkerBoneTable& BoneTable)
 {
 	int Count = 0;
 	char Buffer[1024];
@@ -372,7 +521,7 @@ void FbxStalkerExportSkinnedVisuals(
 		return;
 	}
 
-	FbxNode* Skeleton = FbxStalkerExportSkeleton(Ogf->bones(), Scene);
+	FbxNode* Skeleton = FbxStalkerExportSkeleton(Ogf->bones(), Scene, BoneTable);
 	if (!Skeleton)
 	{
 		FBXSDK_printf("Can't export skeleton hierarchy");
@@ -390,111 +539,245 @@ void FbxStalkerExportSkinnedVisuals(
 			continue;
 		}
 		Scene->GetRootNode()->AddChild(Node);
-		FbxStalkerCreateSkin(Skeleton, Node, Scene, Body->vb());
+		FbxStalkerCreateSkin(BoneTable, Node, Scene, Body->vb());
+	}
+}
+
+// Picks the keys of a channel that linear interpolation between them
+// reproduces within Tolerance (in Scale units). A channel that never
+// leaves Tolerance of its first key is folded to that single key.
+void FbxStalkerReduceKeys(
+	const float* Times,
+	const float* Values,
+	std::size_t NumKeys,
+	double Scale,
+	double Tolerance,
+	std::vector<std::size_t>& Keys)
+{
+	Keys.clear();
+	if (NumKeys == 0)
+	{
+		return;
+	}
+
+	Keys.push_back(0);
+
+	std::size_t KeyId = 1;
+	while (KeyId < NumKeys && std::fabs((Values[KeyId] - Values[0]) * Scale) <= Tolerance)
+	{
+		++KeyId;
+	}
+	if (KeyId == NumKeys)
+	{
+		return;
+	}
+
+	// Grow the segment from the last kept key for as long as it covers
+	// every key in between, then keep the last key that still fitted.
+	std::size_t Anchor = 0;
+	for (std::size_t End = 1; End < NumKeys; ++End)
+	{
+		// A key that doesn't come after the one before it is a step no
+		// line fits across, so both of them are kept.
+		if (Times[End] <= Times[End - 1])
+		{
+			if (Keys.back() != End - 1)
+			{
+				Keys.push_back(End - 1);
+			}
+			Keys.push_back(End);
+			Anchor = End;
+			continue;
+		}
+
+		const double Slope = (double(Values[End]) - Values[Anchor]) / (double(Times[End]) - Times[Anchor]);
+		for (std::size_t Inner = Anchor + 1; Inner < End; ++Inner)
+		{
+			const double Value = Values[Anchor] + Slope * (double(Times[Inner]) - Times[Anchor]);
+			if (std::fabs((Value - Values[Inner]) * Scale) > Tolerance)
+			{
+				Anchor = End - 1;
+				Keys.push_back(Anchor);
+				break;
+			}
+		}
+	}
+	if (Keys.back() != NumKeys - 1)
+	{
+		Keys.push_back(NumKeys - 1);
 	}
 }
 
-void FbxStalkerExportMotion(
+// Keys of one animation curve, ready to be appended.
+struct FbxStalkerCurveKeys
+{
+	std::vector<FbxTime> Times;
+	std::vector<float> Values;
+};
+
+// Curves of one motion, six per bone in bone order: translation X, Y, Z
+// then rotation X, Y, Z.
+struct FbxStalkerMotionKeys
+{
+	std::vector<FbxStalkerCurveKeys> Curves;
+	FbxStalkerKeyStats Stats;
+};
+
+// Converts the envelopes of a motion into FBX curve keys (reduced if
+// asked to). Doesn't touch the SDK, so motions may be baked concurrently.
+void FbxStalkerBakeMotion(
 	const xray_re::xr_skl_motion* Motion,
-	FbxNode* Skeleton,
-	FbxScene* Scene)
+	const FbxStalkerMotionOptions& Options,
+	FbxStalkerMotionKeys& MotionKeys)
 {
 	const float RadToDeg = static_cast<float>(180.0 / M_PI);
 
+	std::vector<std::size_t> Keys;
+
+	const auto& BoneMotions = Motion->bone_motions();
+	MotionKeys.Curves.resize(BoneMotions.size() * 6);
+	for (std::size_t BoneId = 0; BoneId < BoneMotions.size(); ++BoneId)
+	{
+		for (int EnvId = 0; EnvId < 6; ++EnvId)
+		{
+			const auto& Envelope = BoneMotions[BoneId]->envelopes()[EnvId];
+			const bool IsRotation = EnvId >= 3;
+			const float Scale = IsRotation ? RadToDeg : 1.f;
+			const float* Times = Envelope->times();
+			const float* Values = Envelope->values();
+
+			if (Options.ReduceKeys)
+			{
+				FbxStalkerReduceKeys(Times, Values, Envelope->num_keys(), Scale,
+					IsRotation ? Options.RotationTolerance : Options.TranslationTolerance, Keys);
+			}
+			else
+			{
+				Keys.resize(Envelope->num_keys());
+				for (std::size_t KeyId = 0; KeyId < Keys.size(); ++KeyId)
+				{
+					Keys[KeyId] = KeyId;
+				}
+			}
+			MotionKeys.Stats.NumSourceKeys += Envelope->num_keys();
+			MotionKeys.Stats.NumKeys += Keys.size();
+
+			auto& Curve = MotionKeys.Curves[BoneId * 6 + EnvId];
+			Curve.Times.resize(Keys.size());
+			Curve.Values.resize(Keys.size());
+			for (std::size_t KeyId = 0; KeyId < Keys.size(); ++KeyId)
+			{
+				Curve.Times[KeyId].SetSecondDouble(Times[Keys[KeyId]]);
+				Curve.Values[KeyId] = static_cast<float>(Values[Keys[KeyId]] * Scale);
+			}
+		}
+	}
+}
+
+// Creates the anim stack of a baked motion. Keys come in time order, so
+// each curve is sized once and filled with KeyAppendFast(), which makes
+// the same cubic auto-tangent keys as KeyAdd().
+void FbxStalkerWriteMotion(
+	const xray_re::xr_skl_motion* Motion,
+	const FbxStalkerMotionKeys& MotionKeys,
+	const FbxStalkerBoneTable& BoneTable,
+	const FbxStalkerMotionOptions& Options,
+	FbxScene* Scene)
+{
 	const char* const CurveComponents[] = {
 		FBXSDK_CURVENODE_COMPONENT_X,
 		FBXSDK_CURVENODE_COMPONENT_Y,
 		FBXSDK_CURVENODE_COMPONENT_Z
 	};
 
-	FbxTime Time;
-
 	auto AnimStack = FbxAnimStack::Create(Scene, Motion->name().c_str());
 	auto AnimLayer = FbxAnimLayer::Create(Scene, "Base Layer");
 	AnimStack->AddMember(AnimLayer);
 
-	const auto& BoneMotions = Motion->bone_motions();
-	for (int BoneId = 0; BoneId < BoneMotions.size(); ++BoneId)
+	const std::size_t NumBones = MotionKeys.Curves.size() / 6;
+	for (std::size_t BoneId = 0; BoneId < NumBones; ++BoneId)
 	{
-		auto BoneMotion = BoneMotions[BoneId];
-		auto Bone = FbxStalkerGetBone(Skeleton, BoneId);
+		auto Bone = FbxStalkerGetBone(BoneTable, static_cast<int>(BoneId));
+		if (Bone == nullptr)
+		{
+			FBXSDK_printf(
+				"Unexpected bone index #%zu used while trying to export motion '%s'.\n",
+				BoneId, Motion->name().c_str());
+			continue;
+		}
 
 		for (int EnvId = 0; EnvId < 6; ++EnvId)
 		{
-			FbxAnimCurve* Curve;
 			const auto Component = CurveComponents[EnvId % 3];
-			const auto& Envelope = BoneMotion->envelopes()[EnvId];
-
-			if (EnvId < 3)
-			{
-				Curve = Bone->LclTranslation.GetCurve(AnimLayer, Component, true);
-				Curve->KeyModifyBegin();
-				for (const auto& Key : Envelope->keys())
-				{
-					Time.SetSecondDouble(Key->time);
-					int KeyIndex = Curve->KeyAdd(Time);
-					Curve->KeySetValue(KeyIndex, Key->value);
-					Curve->KeySetInterpolation(KeyIndex, FbxAnimCurveDef::eInterpolationCubic);
-				}
-				Curve->KeyModifyEnd();
-			}
-			else
+			const auto& Keys = MotionKeys.Curves[BoneId * 6 + EnvId];
+			const int NumKeys = static_cast<int>(Keys.Times.size());
+
+			FbxAnimCurve* Curve = EnvId >= 3 ?
+				Bone->LclRotation.GetCurve(AnimLayer, Component, true) :
+				Bone->LclTranslation.GetCurve(AnimLayer, Component, true);
+			Curve->KeyModifyBegin();
+			Curve->ResizeKeyBuffer(NumKeys);
+			for (int KeyId = 0; KeyId < NumKeys; ++KeyId)
 			{
-				Curve = Bone->LclRotation.GetCurve(AnimLayer, Component, true);
-				Curve->KeyModifyBegin();
-				for (const auto& Key : Envelope->keys())
+				const int KeyIndex = Curve->KeyAppendFast(Keys.Times[KeyId], Keys.Values[KeyId]);
+				if (Options.ReduceKeys)
 				{
-					Time.SetSecondDouble(Key->time);
-					int KeyIndex = Curve->KeyAdd(Time);
-					Curve->KeySetValue(KeyIndex, static_cast<float>(Key->value * RadToDeg));
-					Curve->KeySetInterpolation(KeyIndex, FbxAnimCurveDef::eInterpolationCubic);
+					Curve->KeySetInterpolation(KeyIndex, FbxAnimCurveDef::eInterpolationLinear);
 				}
-				Curve->KeyModifyEnd();
 			}
+			Curve->KeyModifyEnd();
 		}
 	}
 }
 
-void FbxStalkerExportMotions(
-	const xray_re::xr_file_system& Filesystem,
-	xray_re::xr_ogf* Ogf,
-	FbxScene* Scene,
-	FbxStalkerMotionsExportType ExportType)
+// One motion to export. Motions of OMF sets are decoded by the worker
+// that takes them.
+struct FbxStalkerMotionJob
 {
-	auto RootNode = Scene->GetRootNode();
-	if (RootNode == nullptr)
-	{
-		return;
-	}
+	const xray_re::xr_skl_motion* Motion;
+	std::shared_ptr<const xray_re::xr_ogf_v4> MotionSet;	// null for internal motions
+	std::size_t MotionId;					// in MotionSet->motions()
+	std::string Path;
+	std::string FileName;					// unique within the actor
+	std::unique_ptr<FbxStalkerMotionKeys> Keys;		// set once baked
+	bool Done;
+	bool Failed;
+};
 
-	FbxNode* Skeleton = nullptr;
-	for (int ChildId = 0; ChildId < RootNode->GetChildCount(); ++ChildId)
+// Selected motions of an actor: internal ones first, then those of the
+// referenced OMFs in order. Load() runs on its own thread and only
+// indexes the OMFs, so workers can take motions while it goes on.
+// When streaming, an OMF is only loaded once every motion before it is
+// done, so the sets are held one at a time.
+class FbxStalkerMotionQueue
+{
+public:
+	explicit FbxStalkerMotionQueue(bool Streaming) :
+		Streaming(Streaming)
 	{
-		auto Node = RootNode->GetChild(ChildId);
-		if (Node->GetSkeleton() != nullptr)
-		{
-			Skeleton = Node;
-		}
 	}
 
-	if (Skeleton == nullptr)
+	void Load(
+		const xray_re::xr_file_system& Filesystem,
+		const xray_re::xr_ogf* Ogf,
+		const char* ActorName,
+		FbxStalkerMotionsExportType ExportType,
+		const xray_re::xr_motion_filter& Filter)
 	{
-		Skeleton = FbxStalkerExportSkeleton(Ogf->bones(), Scene);
-		if (Skeleton == nullptr)
+		if (ExportType != FbxStalkerMotionsExportType::eExternalMotionsOnly)
 		{
-			return;
+			std::lock_guard<std::mutex> Lock(Mutex);
+			for (const auto& Motion : Ogf->motions())
+			{
+				if (Filter.match(Motion->name()))
+				{
+					Push(ActorName, Motion, nullptr, 0, std::string());
+				}
+			}
 		}
-	}
-
-	xray_re::xr_skl_motion_vec Motions;
-	if (ExportType != FbxStalkerMotionsExportType::eExternalMotionsOnly)
-	{
-		Motions = Ogf->motions();
-	}
 
-	if (ExportType != FbxStalkerMotionsExportType::eWithInternalMotions)
-	{
-		if (auto OgfV4 = static_cast<xray_re::xr_ogf_v4*>(Ogf))
+		auto OgfV4 = static_cast<const xray_re::xr_ogf_v4*>(Ogf);
+		if (ExportType != FbxStalkerMotionsExportType::eWithInternalMotions && OgfV4)
 		{
 			const char* Span = ",";
 			const char* Ext = ".omf";
@@ -505,127 +788,695 @@ void FbxStalkerExportMotions(
 				std::string Path;
 				auto MotionRef = MotionRefs.GetToken(TokenId, Span);
 				Filesystem.resolve_path(xray_re::PA_GAME_MESHES, MotionRef, Path);
-				OgfV4->load_omf((Path + Ext).c_str());
-				Motions.insert(Motions.end(), Ogf->motions().begin(), Ogf->motions().end());
+				Path += Ext;
+				const auto MotionSet = Open(Path);
+				std::lock_guard<std::mutex> Lock(Mutex);
+				if (Aborted)
+				{
+					break;
+				}
+				if (!MotionSet)
+				{
+					FBXSDK_printf("Can't load motions '%s'.\n", Path.c_str());
+					continue;
+				}
+
+				const auto& Motions = MotionSet->motions();
+				for (std::size_t MotionId = 0; MotionId < Motions.size(); ++MotionId)
+				{
+					if (Filter.match(Motions[MotionId]->name()))
+					{
+						Push(ActorName, Motions[MotionId], MotionSet, MotionId, Path);
+					}
+				}
+				Changed.notify_all();
 			}
 		}
+
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Loaded = true;
+		Changed.notify_all();
 	}
 
-	for (const auto& Motion : Motions)
+	// Next motion to process, or nullptr once all are taken. Waits while
+	// Window motions are taken but not done yet.
+	FbxStalkerMotionJob* Take(std::size_t Window)
 	{
-		FbxStalkerExportMotion(Motion, Skeleton, Scene);
+		std::unique_lock<std::mutex> Lock(Mutex);
+		Changed.wait(Lock, [&]
+		{
+			return Aborted || (NextTake < Jobs.size() && NextTake - NextDone < Window) ||
+				(Loaded && NextTake == Jobs.size());
+		});
+		// Deque elements stay put while the loader appends.
+		return !Aborted && NextTake < Jobs.size() ? &Jobs[NextTake++] : nullptr;
 	}
-}
 
-void FbxStalkerExportLevelVisuals(
-	const xray_re::xr_level_visuals* LevelVisuals,
-	const xray_re::xr_level_shaders* Shaders,
-	FbxScene* Scene)
-{
-	char Name[128];
-
-	const auto& Ogfs = LevelVisuals->ogfs();
-	for (std::size_t OgfId = 0; OgfId < Ogfs.size(); ++OgfId)
+	const xray_re::xr_skl_motion* Decode(const FbxStalkerMotionJob& Job)
 	{
-		const auto* Ogf = Ogfs[OgfId];
-
-		std::snprintf(Name, static_cast<int>(sizeof(Name)), "level_visual_%zu", OgfId);
-
-		FbxNode* Node = FbxNode::Create(Scene, Name);
-		FbxMesh* Mesh = FbxMesh::Create(Scene, Name);
-		if (!FbxStalkerExportStaticMesh(Ogf, Mesh))
+		if (!Job.MotionSet)
 		{
-			FBXSDK_printf("Can't export static mesh '%s'.\n", Name);
-			Mesh->Destroy();
-			continue;
+			return Job.Motion;
 		}
-		Node->AddNodeAttribute(Mesh);
-
-		const int TextureId = Ogf->texture_l();
-		const auto& Textures = Shaders->textures();
-		if (TextureId < Textures.size())
+		if (Streaming)
 		{
-			const auto Name = Textures[TextureId].c_str();
-			if (auto* Material = Scene->GetMaterial(FbxStalkerGetBaseFilename(Name)))
-			{
-				Node->AddMaterial(Material);
-			}
+			return Job.MotionSet->decode_motion(Job.MotionId);
 		}
+		return xray_re::xr_omf_cache::instance().decode(Job.Path, Job.MotionSet, Job.MotionId);
+	}
 
-		if (const auto* OgfV4 = dynamic_cast<const xray_re::xr_ogf_v4*>(Ogf))
+	// Drops the envelopes of a baked motion when streaming; its keys are
+	// all that is needed from then on.
+	void Release(const FbxStalkerMotionJob& Job)
+	{
+		if (Streaming && Job.MotionSet)
 		{
-			const auto& Xform = OgfV4->xform();
-			if (!Xform.is_identity())
-			{
-				float Rx, Ry, Rz;
-
-				const float RadToDeg = static_cast<float>(180.0 / M_PI);
-
-				Xform.get_euler_xyz(Rx, Ry, Rz);
-				Node->LclRotation.Set(FbxVector4(Rx * RadToDeg, Ry * RadToDeg, Rz * RadToDeg));
-				Node->LclTranslation.Set(FbxVector4(Xform._41, Xform._42, Xform._43));
-			}
+			Job.MotionSet->release_motion(Job.MotionId);
 		}
-
-		Scene->GetRootNode()->AddChild(Node);
 	}
-}
 
-void FbxStalkerExportLevelMaterials(
-	const xray_re::xr_file_system& Filesystem,
-	const xray_re::xr_level_shaders* Shaders,
-	FbxScene* Scene)
-{
-	for (const auto& RelativePath : Shaders->textures())
+	void Baked(FbxStalkerMotionJob& Job, std::unique_ptr<FbxStalkerMotionKeys> Keys)
 	{
-		FbxStalkerExportMaterial(
-			Filesystem,
-			RelativePath.c_str(),
-			Scene);
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Job.Keys = std::move(Keys);
+		Changed.notify_all();
 	}
-}
-
-void FbxStalkerExportLevelCollision(
-	xray_re::xr_level_cform* Cform,
-	FbxScene* Scene)
-{
-	const auto& Verts = Cform->vertices();
-	const auto& Faces = Cform->faces();
 
-	if (Verts.empty() || Faces.empty())
+	// Next baked motion in queue order, or nullptr once all are done.
+	FbxStalkerMotionJob* NextBaked()
 	{
-		return;
+		std::unique_lock<std::mutex> Lock(Mutex);
+		Changed.wait(Lock, [&]
+		{
+			return Aborted || (NextDone < Jobs.size() && Jobs[NextDone].Keys) ||
+				(Loaded && NextDone == Jobs.size());
+		});
+		return !Aborted && NextDone < Jobs.size() ? &Jobs[NextDone] : nullptr;
 	}
 
-	const auto Name = FbxString(Scene->GetName()) + "_cform";
-	if (Scene->FindNodeByName(Name))
+	// Releases the keys and the motion set of a processed motion.
+	void Done(FbxStalkerMotionJob& Job)
 	{
-		FBXSDK_printf("Collision form already exists.\n");
-		return;
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Job.Keys.reset();
+		Job.MotionSet.reset();
+		Job.Done = true;
+		while (NextDone < Jobs.size() && Jobs[NextDone].Done)
+		{
+			++NextDone;
+		}
+		Changed.notify_all();
 	}
 
-	auto* Mesh = FbxMesh::Create(Scene, Name);
-	auto* Node = FbxNode::Create(Scene, Name);
-
-	Mesh->InitControlPoints(static_cast<int>(Verts.size()));
-
-	FbxVector4* ControlPoints = Mesh->GetControlPoints();
-	for (std::size_t VertId = 0; VertId < Verts.size(); ++VertId)
+	// Makes every stage give up: nothing more is loaded or handed out, and
+	// whoever waits for the queue returns.
+	void Abort()
 	{
-		ControlPoints[VertId].Set(
-			Verts[VertId].p.x,
-			Verts[VertId].p.y,
-			Verts[VertId].p.z
-		);
+		std::lock_guard<std::mutex> Lock(Mutex);
+		Aborted = true;
+		Changed.notify_all();
 	}
 
-	for (std::size_t FaceId = 0; FaceId < Faces.size(); ++FaceId)
+	// Only once loading is over.
+	const std::deque<FbxStalkerMotionJob>& GetJobs() const
 	{
-		Mesh->BeginPolygon(0);
-		Mesh->AddPolygon(Faces[FaceId].v0);
-		Mesh->AddPolygon(Faces[FaceId].v1);
-		Mesh->AddPolygon(Faces[FaceId].v2);
-		Mesh->EndPolygon();
+		return Jobs;
+	}
+
+private:
+	std::shared_ptr<const xray_re::xr_ogf_v4> Open(const std::string& Path)
+	{
+		if (!Streaming)
+		{
+			return xray_re::xr_omf_cache::instance().open(Path);
+		}
+
+		{
+			std::unique_lock<std::mutex> Lock(Mutex);
+			Changed.wait(Lock, [&]
+			{
+				return Aborted || NextDone == Jobs.size();
+			});
+			if (Aborted)
+			{
+				return nullptr;
+			}
+		}
+
+		std::shared_ptr<xray_re::xr_ogf_v4> MotionSet(new xray_re::xr_ogf_v4);
+		MotionSet->set_lazy_motions(true);
+		if (!MotionSet->load_omf(Path.c_str()))
+		{
+			return nullptr;
+		}
+		return MotionSet;
+	}
+
+	void Push(
+		const char* ActorName,
+		const xray_re::xr_skl_motion* Motion,
+		const std::shared_ptr<const xray_re::xr_ogf_v4>& MotionSet,
+		std::size_t MotionId,
+		const std::string& Path)
+	{
+		std::string FileName = std::string(ActorName) + '@' + Motion->name();
+		for (auto& Char : FileName)
+		{
+			if (!std::isalnum(static_cast<unsigned char>(Char)) && Char != '@' && Char != '_' && Char != '-')
+			{
+				Char = '_';
+			}
+		}
+		// A suffix may itself clash with another motion's name, and names
+		// that only differ in case clash on Windows.
+		std::string Unique = FileName;
+		for (int Count = 2; ; ++Count)
+		{
+			std::string Key = Unique;
+			xray_re::xr_strlwr(Key);
+			if (FileNames.insert(Key).second)
+			{
+				break;
+			}
+			Unique = FileName + '_' + std::to_string(Count);
+		}
+		Jobs.push_back({ Motion, MotionSet, MotionId, Path, Unique, nullptr, false, false });
+	}
+
+	const bool Streaming;
+	std::mutex Mutex;
+	std::condition_variable Changed;
+	std::deque<FbxStalkerMotionJob> Jobs;
+	std::set<std::string> FileNames;	// lowercased
+	bool Loaded = false;
+	bool Aborted = false;
+	std::size_t NextTake = 0;
+	std::size_t NextDone = 0;	// every motion before it is done
+};
+
+// Runs the stages of a motion export on threads of their own. A stage
+// that throws aborts the queue, so that the others stop as well, and
+// Join() rethrows the first exception once every thread is done, like
+// xr_parallel_for() does. Threads are aborted and joined on destruction,
+// so leaving the scope on an exception never leaves one running.
+class FbxStalkerMotionThreads
+{
+public:
+	explicit FbxStalkerMotionThreads(FbxStalkerMotionQueue& Queue) :
+		Queue(Queue)
+	{
+	}
+
+	~FbxStalkerMotionThreads()
+	{
+		if (!Threads.empty())
+		{
+			Queue.Abort();
+			JoinAll();
+		}
+	}
+
+	template<typename Function>
+	void Run(Function Func)
+	{
+		Threads.emplace_back([this, Func]
+		{
+			try
+			{
+				Func();
+			}
+			catch (...)
+			{
+				{
+					std::lock_guard<std::mutex> Lock(Mutex);
+					if (!Error)
+					{
+						Error = std::current_exception();
+					}
+				}
+				Queue.Abort();
+			}
+		});
+	}
+
+	void Join()
+	{
+		JoinAll();
+		if (Error)
+		{
+			std::rethrow_exception(Error);
+		}
+	}
+
+private:
+	void JoinAll()
+	{
+		for (auto& Thread : Threads)
+		{
+			Thread.join();
+		}
+		Threads.clear();
+	}
+
+	FbxStalkerMotionQueue& Queue;
+	std::vector<std::thread> Threads;
+	std::mutex Mutex;
+	std::exception_ptr Error;
+};
+
+void FbxStalkerExportMotions(
+	const xray_re::xr_file_system& Filesystem,
+	xray_re::xr_ogf* Ogf,
+	FbxScene* Scene,
+	FbxStalkerBoneTable& BoneTable,
+	FbxStalkerMotionsExportType ExportType,
+	const FbxStalkerMotionOptions& Options)
+{
+	if (BoneTable.empty())
+	{
+		FbxNode* Skeleton = FbxStalkerExportSkeleton(Ogf->bones(), Scene, BoneTable);
+		if (Skeleton == nullptr)
+		{
+			return;
+		}
+		Scene->GetRootNode()->AddChild(Skeleton);
+	}
+
+	// Three stages run at once: a loader thread indexes the referenced
+	// OMFs, workers decode and bake the selected motions, and this thread
+	// writes the anim stacks (the SDK is single-threaded) in motion order.
+	// Workers run at most Window motions ahead of the writer, which bounds
+	// the memory held by baked keys.
+	const unsigned NumWorkers = std::max(1u, xray_re::xr_num_threads() - 1);
+	const std::size_t Window = 4 * NumWorkers;
+
+	FbxStalkerMotionQueue Queue(Options.Streaming);
+	FbxStalkerMotionThreads Threads(Queue);
+	Threads.Run([&]
+	{
+		Queue.Load(Filesystem, Ogf, Scene->GetName(), ExportType, Options.Filter);
+	});
+
+	for (unsigned WorkerId = 0; WorkerId < NumWorkers; ++WorkerId)
+	{
+		Threads.Run([&]
+		{
+			while (auto Job = Queue.Take(Window))
+			{
+				const auto* Motion = Queue.Decode(*Job);
+				std::unique_ptr<FbxStalkerMotionKeys> Keys(new FbxStalkerMotionKeys);
+				FbxStalkerBakeMotion(Motion, Options, *Keys);
+				Queue.Release(*Job);
+				Queue.Baked(*Job, std::move(Keys));
+			}
+		});
+	}
+
+	FbxStalkerKeyStats Stats;
+	while (auto Job = Queue.NextBaked())
+	{
+		FbxStalkerWriteMotion(Job->Motion, *Job->Keys, BoneTable, Options, Scene);
+		Stats.NumSourceKeys += Job->Keys->Stats.NumSourceKeys;
+		Stats.NumKeys += Job->Keys->Stats.NumKeys;
+		Queue.Done(*Job);
+	}
+	Threads.Join();
+
+	if (Options.ReduceKeys && Stats.NumSourceKeys != 0)
+	{
+		FBXSDK_printf("%zu motions: %zu of %zu keys kept (%.1f%%)\n",
+			Queue.GetJobs().size(), Stats.NumKeys, Stats.NumSourceKeys,
+			100.0 * Stats.NumKeys / Stats.NumSourceKeys);
+	}
+}
+
+// The vertex and index ranges a visual draws. Level visuals proxy the
+// shared geometry containers, so visuals with equal keys (trees and other
+// models placed several times, which only differ in xform()) are the
+// same geometry.
+using FbxStalkerGeometryKey = std::tuple<
+	const xray_re::fvector3*, const xray_re::fvector3*, const xray_re::fvector2*, std::size_t,
+	const uint16_t*, std::size_t>;
+
+inline FbxStalkerGeometryKey FbxStalkerGetGeometryKey(
+	const xray_re::xr_ogf* Ogf,
+	unsigned SwiLod)
+{
+	const auto& VertexBuffer = Ogf->vb();
+
+	xray_re::xr_ibuf IndexBuffer;
+	const std::size_t NumVerts = FbxStalkerGetLodIndices(Ogf, SwiLod, IndexBuffer);
+	return FbxStalkerGeometryKey(
+		VertexBuffer.p(), VertexBuffer.n(), VertexBuffer.tc(), NumVerts,
+		IndexBuffer.size() ? &IndexBuffer[0] : nullptr, IndexBuffer.size());
+}
+
+// Writes a node per level visual. Visuals sharing their geometry share a
+// single mesh as well, placed by the transforms of their nodes.
+void FbxStalkerExportLevelVisuals(
+	const xray_re::xr_level_visuals* LevelVisuals,
+	const xray_re::xr_level_shaders* Shaders,
+	const std::vector<std::size_t>& OgfIds,
+	unsigned SwiLod,
+	FbxScene* Scene)
+{
+	char Name[128];
+
+	std::map<FbxStalkerGeometryKey, FbxMesh*> Meshes;
+	std::size_t NumInstances = 0;
+
+	const auto& Ogfs = LevelVisuals->ogfs();
+	for (const auto OgfId : OgfIds)
+	{
+		const auto* Ogf = Ogfs[OgfId];
+
+		std::snprintf(Name, static_cast<int>(sizeof(Name)), "level_visual_%zu", OgfId);
+
+		FbxMesh* Mesh = nullptr;
+		const auto Key = FbxStalkerGetGeometryKey(Ogf, SwiLod);
+		const auto MeshIt = Meshes.find(Key);
+		if (MeshIt != Meshes.end())
+		{
+			Mesh = MeshIt->second;
+			++NumInstances;
+		}
+		else
+		{
+			Mesh = FbxMesh::Create(Scene, Name);
+			if (!FbxStalkerExportStaticMesh(Ogf, SwiLod, Mesh))
+			{
+				FBXSDK_printf("Can't export static mesh '%s'.\n", Name);
+				Mesh->Destroy();
+				continue;
+			}
+			Meshes.emplace(Key, Mesh);
+		}
+
+		FbxNode* Node = FbxNode::Create(Scene, Name);
+		Node->AddNodeAttribute(Mesh);
+
+		const int TextureId = Ogf->texture_l();
+		const auto& Textures = Shaders->textures();
+		if (TextureId < Textures.size())
+		{
+			const auto Name = Textures[TextureId].c_str();
+			if (auto* Material = Scene->GetMaterial(FbxStalkerGetBaseFilename(Name)))
+			{
+				Node->AddMaterial(Material);
+			}
+		}
+
+		if (const auto* OgfV4 = dynamic_cast<const xray_re::xr_ogf_v4*>(Ogf))
+		{
+			const auto& Xform = OgfV4->xform();
+			if (!Xform.is_identity())
+			{
+				float Rx, Ry, Rz;
+
+				const float RadToDeg = static_cast<float>(180.0 / M_PI);
+
+				// Shared meshes rely on the node for the whole transform,
+				// scaled trees included.
+				xray_re::fmatrix Rotation = Xform;
+				const float Sx = Rotation.i.magnitude();
+				const float Sy = Rotation.j.magnitude();
+				const float Sz = Rotation.k.magnitude();
+				Rotation.i.div(Sx);
+				Rotation.j.div(Sy);
+				Rotation.k.div(Sz);
+
+				Rotation.get_euler_xyz(Rx, Ry, Rz);
+				Node->LclRotation.Set(FbxVector4(Rx * RadToDeg, Ry * RadToDeg, Rz * RadToDeg));
+				Node->LclTranslation.Set(FbxVector4(Xform._41, Xform._42, Xform._43));
+				Node->LclScaling.Set(FbxVector4(Sx, Sy, Sz));
+			}
+		}
+
+		Scene->GetRootNode()->AddChild(Node);
+	}
+
+	if (NumInstances != 0)
+	{
+		FBXSDK_printf("%zu level visuals share %zu meshes\n", Meshes.size() + NumInstances, Meshes.size());
+	}
+}
+
+// Level visuals of one material in world space. Indices are 32 bit, a
+// merged mesh soon outgrows what the 16 bit xr_ibuf can address.
+struct FbxStalkerMergedMesh
+{
+	uint32_t TextureId = 0;
+	uint32_t ShaderId = 0;
+	std::size_t NumVerts = 0;
+	std::vector<const xray_re::xr_ogf*> Ogfs;
+
+	std::vector<xray_re::fvector3> Points;
+	std::vector<xray_re::fvector3> Normals;
+	std::vector<xray_re::fvector2> UVs;
+	std::vector<uint32_t> Indices;
+};
+
+inline bool FbxStalkerHasStaticMesh(const xray_re::xr_ogf* Ogf)
+{
+	const auto& VertexBuffer = Ogf->vb();
+	return VertexBuffer.p() && VertexBuffer.n() && VertexBuffer.tc() && Ogf->ib().size() >= 3;
+}
+
+void FbxStalkerMergeVisual(
+	const xray_re::xr_ogf* Ogf,
+	unsigned SwiLod,
+	FbxStalkerMergedMesh& Merged)
+{
+	const auto& VertexBuffer = Ogf->vb();
+
+	xray_re::xr_ibuf IndexBuffer;
+	const std::size_t NumVerts = FbxStalkerGetLodIndices(Ogf, SwiLod, IndexBuffer);
+
+	const xray_re::fmatrix* Xform = nullptr;
+	if (const auto* OgfV4 = dynamic_cast<const xray_re::xr_ogf_v4*>(Ogf))
+	{
+		if (!OgfV4->xform().is_identity())
+		{
+			Xform = &OgfV4->xform();
+		}
+	}
+
+	// Normals go by the inverse transpose of the upper 3x3, so they stay
+	// perpendicular under non-uniform scale. The cofactor matrix is that
+	// times the determinant, which only matters by its sign here.
+	xray_re::fmatrix NormalXform;
+	if (Xform)
+	{
+		NormalXform.identity();
+		NormalXform.i.cross_product(Xform->j, Xform->k);
+		NormalXform.j.cross_product(Xform->k, Xform->i);
+		NormalXform.k.cross_product(Xform->i, Xform->j);
+		if (Xform->i.dot_product(NormalXform.i) < 0)
+		{
+			NormalXform.i.invert();
+			NormalXform.j.invert();
+			NormalXform.k.invert();
+		}
+	}
+
+	const uint32_t Base = static_cast<uint32_t>(Merged.Points.size());
+	for (std::size_t VertId = 0; VertId < NumVerts; ++VertId)
+	{
+		xray_re::fvector3 Point = VertexBuffer.p()[VertId];
+		xray_re::fvector3 Normal = VertexBuffer.n()[VertId];
+		if (Xform)
+		{
+			Point.transform(*Xform);
+			Normal.rotate(NormalXform).normalize_safe();
+		}
+		Merged.Points.push_back(Point);
+		Merged.Normals.push_back(Normal);
+		Merged.UVs.push_back(VertexBuffer.tc()[VertId]);
+	}
+
+	const std::size_t NumIndices = IndexBuffer.size() / 3 * 3;
+	for (std::size_t IndexId = 0; IndexId < NumIndices; ++IndexId)
+	{
+		Merged.Indices.push_back(Base + IndexBuffer[IndexId]);
+	}
+}
+
+// Writes one mesh per material (texture and shader pair) holding every
+// level visual that uses it, so the scene gets a handful of nodes instead
+// of one per visual. Meshes are assembled in parallel, then written in
+// material order.
+void FbxStalkerExportMergedLevelVisuals(
+	const xray_re::xr_level_visuals* LevelVisuals,
+	const xray_re::xr_level_shaders* Shaders,
+	const std::vector<std::size_t>& OgfIds,
+	const FbxStalkerLevelOptions& Options,
+	unsigned NumThreads,
+	FbxScene* Scene)
+{
+	std::map<std::pair<uint32_t, uint32_t>, std::vector<const xray_re::xr_ogf*>> Materials;
+	std::size_t NumVisuals = 0;
+	for (const auto OgfId : OgfIds)
+	{
+		const auto* Ogf = LevelVisuals->ogfs()[OgfId];
+		if (FbxStalkerHasStaticMesh(Ogf))
+		{
+			Materials[{ Ogf->texture_l(), Ogf->shader_l() }].push_back(Ogf);
+			++NumVisuals;
+		}
+	}
+
+	std::vector<FbxStalkerMergedMesh> Meshes;
+	for (const auto& Material : Materials)
+	{
+		std::size_t First = Meshes.size();
+		for (const auto* Ogf : Material.second)
+		{
+			xray_re::xr_ibuf IndexBuffer;
+			const std::size_t NumVerts = FbxStalkerGetLodIndices(Ogf, Options.SwiLod, IndexBuffer);
+			if (Meshes.size() == First ||
+				(Options.MaxMergedVertices != 0 &&
+					Meshes.back().NumVerts + NumVerts > Options.MaxMergedVertices))
+			{
+				Meshes.emplace_back();
+				Meshes.back().TextureId = Material.first.first;
+				Meshes.back().ShaderId = Material.first.second;
+			}
+			Meshes.back().Ogfs.push_back(Ogf);
+			Meshes.back().NumVerts += NumVerts;
+		}
+	}
+
+	xray_re::xr_parallel_for(Meshes.size(), [&](std::size_t MeshId)
+	{
+		auto& Merged = Meshes[MeshId];
+		Merged.Points.reserve(Merged.NumVerts);
+		Merged.Normals.reserve(Merged.NumVerts);
+		Merged.UVs.reserve(Merged.NumVerts);
+		for (const auto* Ogf : Merged.Ogfs)
+		{
+			FbxStalkerMergeVisual(Ogf, Options.SwiLod, Merged);
+		}
+	}, NumThreads);
+
+	char Name[128];
+
+	const auto& Textures = Shaders->textures();
+	for (std::size_t MeshId = 0; MeshId < Meshes.size(); ++MeshId)
+	{
+		auto& Merged = Meshes[MeshId];
+
+		std::snprintf(Name, static_cast<int>(sizeof(Name)), "level_merged_%zu", MeshId);
+
+		FbxNode* Node = FbxNode::Create(Scene, Name);
+		FbxMesh* Mesh = FbxMesh::Create(Scene, Name);
+		if (!FbxStalkerFillMesh(
+			Merged.Points.data(), Merged.Normals.data(), Merged.UVs.data(), Merged.Points.size(),
+			Merged.Indices, Merged.Indices.size(), Mesh))
+		{
+			FBXSDK_printf("Can't export merged mesh '%s'.\n", Name);
+			Mesh->Destroy();
+			continue;
+		}
+		Node->AddNodeAttribute(Mesh);
+
+		if (Merged.TextureId < Textures.size())
+		{
+			const auto Name = Textures[Merged.TextureId].c_str();
+			if (auto* Material = Scene->GetMaterial(FbxStalkerGetBaseFilename(Name)))
+			{
+				Node->AddMaterial(Material);
+			}
+		}
+
+		Scene->GetRootNode()->AddChild(Node);
+
+		// The scene has its own copy now.
+		Merged = FbxStalkerMergedMesh();
+	}
+
+	FBXSDK_printf("%zu level visuals merged into %zu meshes\n", NumVisuals, Meshes.size());
+}
+
+void FbxStalkerExportLevelMaterials(
+	const xray_re::xr_file_system& Filesystem,
+	const xray_re::xr_level_shaders* Shaders,
+	FbxScene* Scene)
+{
+	for (const auto& RelativePath : Shaders->textures())
+	{
+		FbxStalkerExportMaterial(
+			Filesystem,
+			RelativePath.c_str(),
+			Scene);
+	}
+}
+
+void FbxStalkerExportLevelCollision(
+	const xray_re::xr_level_cform* Cform,
+	const std::vector<std::size_t>& FaceIds,
+	FbxScene* Scene)
+{
+	const auto& Verts = Cform->vertices();
+	const auto& Faces = Cform->faces();
+
+	if (Verts.empty() || FaceIds.empty())
+	{
+		return;
+	}
+
+	const auto Name = FbxString(Scene->GetName()) + "_cform";
+	if (Scene->FindNodeByName(Name))
+	{
+		FBXSDK_printf("Collision form already exists.\n");
+		return;
+	}
+
+	// Keep just the vertices the faces use, in their original order.
+	std::vector<int> VertMap(Verts.size(), -1);
+	for (const auto FaceId : FaceIds)
+	{
+		for (const auto VertId : Faces[FaceId].v)
+		{
+			VertMap[VertId] = 0;
+		}
+	}
+	int NumVerts = 0;
+	for (auto& Mapped : VertMap)
+	{
+		if (Mapped == 0)
+		{
+			Mapped = NumVerts++;
+		}
+	}
+
+	auto* Mesh = FbxMesh::Create(Scene, Name);
+	auto* Node = FbxNode::Create(Scene, Name);
+
+	Mesh->InitControlPoints(NumVerts);
+
+	FbxVector4* ControlPoints = Mesh->GetControlPoints();
+	for (std::size_t VertId = 0; VertId < Verts.size(); ++VertId)
+	{
+		if (VertMap[VertId] < 0)
+		{
+			continue;
+		}
+		ControlPoints[VertMap[VertId]].Set(
+			Verts[VertId].p.x,
+			Verts[VertId].p.y,
+			Verts[VertId].p.z
+		);
+	}
+
+	Mesh->ReservePolygonCount(static_cast<int>(FaceIds.size()));
+	Mesh->ReservePolygonVertexCount(static_cast<int>(FaceIds.size()) * 3);
+	for (const auto FaceId : FaceIds)
+	{
+		Mesh->BeginPolygon(0);
+		Mesh->AddPolygon(VertMap[Faces[FaceId].v0]);
+		Mesh->AddPolygon(VertMap[Faces[FaceId].v1]);
+		Mesh->AddPolygon(VertMap[Faces[FaceId].v2]);
+		Mesh->EndPolygon();
 	}
 
 	Node->AddNodeAttribute(Mesh);
@@ -661,93 +1512,488 @@ FbxScene* FbxStalkerBeginExportScene(
 	return Scene;
 }
 
-void FbxStalkerEndExportScene(
-	FbxManager* SdkManager,
-	const char* TargetPath,
-	FbxScene* Scene)
-{
-	char FileName[1024];
-	int FileFormat = 0;
+bool FbxStalkerEndExportScene(
+	FbxManager* SdkManager,
+	const char* TargetPath,
+	FbxScene* Scene)
+{
+	std::string FileName = TargetPath;
+	xray_re::xr_file_system::append_path_separator(FileName);
+	FileName.append(Scene->GetName()).append(".fbx");
+	xray_re::xr_file_system::normalize_path(FileName);
+
+	int FileFormat = 0;
+
+	FbxExporter* Exporter = FbxExporter::Create(SdkManager, "");
+	FileFormat = SdkManager->GetIOPluginRegistry()->GetNativeWriterFormat();
+	if (Exporter->Initialize(FileName.c_str(), FileFormat, SdkManager->GetIOSettings()) == false)
+	{
+		FBXSDK_printf("Call to FbxExporter::Initialize() failed.\n");
+		FBXSDK_printf("Error returned: %s\n\n", Exporter->GetStatus().GetErrorString());
+		Exporter->Destroy();
+		Scene->Destroy();
+		return false;
+	}
+
+	// Convert the entire scene back to the fbx coordinate system
+
+	FbxAxisSystem(
+		FbxAxisSystem::EUpVector::eYAxis,
+		FbxAxisSystem::EFrontVector::eParityOdd,
+		FbxAxisSystem::ECoordSystem::eRightHanded
+	).DeepConvertScene(Scene);
+
+	const bool Result = Exporter->Export(Scene);
+	Exporter->Destroy();
+	Scene->Destroy();
+	return Result;
+}
+
+FbxManager* FbxStalkerCreateManager()
+{
+	FbxManager* SdkManager = FbxManager::Create();
+	FbxIOSettings* IOSettings = FbxIOSettings::Create(SdkManager, IOSROOT);
+	IOSettings->SetBoolProp(EXP_FBX_EMBEDDED, IOSEnabled);
+	SdkManager->SetIOSettings(IOSettings);
+	return SdkManager;
+}
+
+// A part of a tiled level: the level visuals and the collision faces that
+// fall into it.
+struct FbxStalkerLevelTile
+{
+	std::string Name;
+	std::vector<std::size_t> Visuals;
+	std::vector<std::size_t> Faces;
+	xray_re::fbox Bounds;
+	bool Failed = false;
+};
+
+// Sorts the level geometry into tiles. On a grid, visuals go by the centre
+// of their bounding box and collision faces by their centroid; otherwise
+// visuals go by the sector whose hierarchy holds them and faces by their
+// sector field.
+bool FbxStalkerBuildLevelTiles(
+	const xray_re::xr_level& Level,
+	const char* LevelName,
+	const FbxStalkerLevelOptions& Options,
+	std::vector<FbxStalkerLevelTile>& Tiles)
+{
+	const auto& Ogfs = Level.visuals()->ogfs();
+	const auto* Cform = Level.cform();
+
+	if (Options.TileBySectors)
+	{
+		const auto* Sectors = Level.sectors();
+		if (Sectors == nullptr)
+		{
+			FBXSDK_printf("Level '%s' has no sectors.\n", LevelName);
+			return false;
+		}
+
+		// One more tile for the visuals no sector refers to.
+		const std::size_t NumSectors = Sectors->sectors().size();
+		Tiles.resize(NumSectors + 1);
+		for (std::size_t SectorId = 0; SectorId < NumSectors; ++SectorId)
+		{
+			Tiles[SectorId].Name = std::string(LevelName) + "_sector_" + std::to_string(SectorId);
+		}
+		Tiles[NumSectors].Name = std::string(LevelName) + "_unsectored";
+
+		std::vector<bool> Visited(Ogfs.size(), false);
+		for (std::size_t SectorId = 0; SectorId < NumSectors; ++SectorId)
+		{
+			std::vector<uint32_t> Pending(1, Sectors->sectors()[SectorId]->root);
+			while (!Pending.empty())
+			{
+				const uint32_t OgfId = Pending.back();
+				Pending.pop_back();
+				if (OgfId >= Ogfs.size() || Visited[OgfId])
+				{
+					continue;
+				}
+				Visited[OgfId] = true;
+
+				const auto* Ogf = Ogfs[OgfId];
+				Pending.insert(Pending.end(), Ogf->children_l().begin(), Ogf->children_l().end());
+				if (FbxStalkerHasStaticMesh(Ogf))
+				{
+					Tiles[SectorId].Visuals.push_back(OgfId);
+				}
+			}
+		}
+		for (std::size_t OgfId = 0; OgfId < Ogfs.size(); ++OgfId)
+		{
+			if (!Visited[OgfId] && FbxStalkerHasStaticMesh(Ogfs[OgfId]))
+			{
+				Tiles[NumSectors].Visuals.push_back(OgfId);
+			}
+		}
+
+		if (Cform)
+		{
+			const auto& Faces = Cform->faces();
+			for (std::size_t FaceId = 0; FaceId < Faces.size(); ++FaceId)
+			{
+				const std::size_t SectorId = Faces[FaceId].sector;
+				Tiles[SectorId < NumSectors ? SectorId : NumSectors].Faces.push_back(FaceId);
+			}
+		}
+	}
+	else
+	{
+		std::map<std::pair<int, int>, FbxStalkerLevelTile> Cells;
+		const auto GetCell = [&](const xray_re::fvector3& Point) -> FbxStalkerLevelTile&
+		{
+			const int X = static_cast<int>(std::floor(Point.x / Options.TileSize));
+			const int Z = static_cast<int>(std::floor(Point.z / Options.TileSize));
+			auto& Tile = Cells[{ X, Z }];
+			if (Tile.Name.empty())
+			{
+				Tile.Name = std::string(LevelName) + "_tile_" + std::to_string(X) + '_' + std::to_string(Z);
+			}
+			return Tile;
+		};
+
+		for (std::size_t OgfId = 0; OgfId < Ogfs.size(); ++OgfId)
+		{
+			if (FbxStalkerHasStaticMesh(Ogfs[OgfId]))
+			{
+				xray_re::fvector3 Center;
+				Ogfs[OgfId]->bbox().center(Center);
+				GetCell(Center).Visuals.push_back(OgfId);
+			}
+		}
+
+		if (Cform)
+		{
+			const auto& Verts = Cform->vertices();
+			const auto& Faces = Cform->faces();
+			for (std::size_t FaceId = 0; FaceId < Faces.size(); ++FaceId)
+			{
+				const auto& Face = Faces[FaceId];
+				xray_re::fvector3 Center;
+				Center.add(Verts[Face.v0].p, Verts[Face.v1].p).add(Verts[Face.v2].p).mul(1.f / 3);
+				GetCell(Center).Faces.push_back(FaceId);
+			}
+		}
+
+		for (auto& Cell : Cells)
+		{
+			Tiles.push_back(std::move(Cell.second));
+		}
+	}
+
+	Tiles.erase(std::remove_if(Tiles.begin(), Tiles.end(), [](const FbxStalkerLevelTile& Tile)
+	{
+		return Tile.Visuals.empty() && Tile.Faces.empty();
+	}), Tiles.end());
+
+	for (auto& Tile : Tiles)
+	{
+		Tile.Bounds.invalidate();
+		for (const auto OgfId : Tile.Visuals)
+		{
+			Tile.Bounds.merge(Ogfs[OgfId]->bbox());
+		}
+		for (const auto FaceId : Tile.Faces)
+		{
+			for (const auto VertId : Cform->faces()[FaceId].v)
+			{
+				Tile.Bounds.extend(Cform->vertices()[VertId].p);
+			}
+		}
+	}
+	return true;
+}
+
+// Writes every tile of the level to its own FBX. Tiles are written
+// concurrently, every worker with an SDK manager of its own, and listed
+// with their bounds in <level>.tiles.ltx.
+bool FbxStalkerExportLevelTiles(
+	const xray_re::xr_file_system& Filesystem,
+	const xray_re::xr_level& Level,
+	const char* LevelName,
+	const char* TargetPath,
+	const FbxStalkerLevelOptions& Options)
+{
+	std::vector<FbxStalkerLevelTile> Tiles;
+	if (!FbxStalkerBuildLevelTiles(Level, LevelName, Options, Tiles))
+	{
+		return false;
+	}
+
+	const auto* Shaders = Level.shaders();
+	const auto& Textures = Shaders->textures();
+
+	std::atomic<std::size_t> NextTile(0);
+	std::vector<std::thread> Workers;
+	const std::size_t NumWorkers = std::min<std::size_t>(xray_re::xr_num_threads(), Tiles.size());
+	for (std::size_t WorkerId = 0; WorkerId < NumWorkers; ++WorkerId)
+	{
+		Workers.emplace_back([&]
+		{
+			FbxManager* SdkManager = FbxStalkerCreateManager();
+			for (std::size_t TileId; (TileId = NextTile++) < Tiles.size();)
+			{
+				auto& Tile = Tiles[TileId];
+				FbxScene* Scene = FbxStalkerBeginExportScene(SdkManager, Tile.Name.c_str());
+				if (Scene == nullptr)
+				{
+					Tile.Failed = true;
+					continue;
+				}
+
+				for (const auto OgfId : Tile.Visuals)
+				{
+					const uint32_t TextureId = Level.visuals()->ogfs()[OgfId]->texture_l();
+					if (TextureId < Textures.size())
+					{
+						FbxStalkerExportMaterial(Filesystem, Textures[TextureId].c_str(), Scene);
+					}
+				}
+				if (Options.MergeByMaterial)
+				{
+					// Tiles run in parallel already.
+					FbxStalkerExportMergedLevelVisuals(Level.visuals(), Shaders, Tile.Visuals, Options, 1, Scene);
+				}
+				else
+				{
+					FbxStalkerExportLevelVisuals(Level.visuals(), Shaders, Tile.Visuals, Options.SwiLod, Scene);
+				}
+				if (Level.cform())
+				{
+					FbxStalkerExportLevelCollision(Level.cform(), Tile.Faces, Scene);
+				}
+
+				Tile.Failed = !FbxStalkerEndExportScene(SdkManager, TargetPath, Scene);
+				if (Tile.Failed)
+				{
+					FBXSDK_printf("Failed to export level tile '%s'.\n", Tile.Name.c_str());
+				}
+			}
+			SdkManager->Destroy();
+		});
+	}
+
+	for (auto& Worker : Workers)
+	{
+		Worker.join();
+	}
 
-	std::snprintf(FileName, sizeof(FileName), "%s\\%s.fbx", TargetPath, Scene->GetName());
+	std::string ManifestName = TargetPath;
+	xray_re::xr_file_system::append_path_separator(ManifestName);
+	ManifestName.append(LevelName).append(".tiles.ltx");
+	xray_re::xr_file_system::normalize_path(ManifestName);
 
-	FbxExporter* Exporter = FbxExporter::Create(SdkManager, "");
-	FileFormat = SdkManager->GetIOPluginRegistry()->GetNativeWriterFormat();
-	if (Exporter->Initialize(FileName, FileFormat, SdkManager->GetIOSettings()) == false)
+	std::ofstream Manifest(ManifestName);
+	Manifest << "[tiles]\n";
+	if (!Options.TileBySectors)
 	{
-		FBXSDK_printf("Call to FbxExporter::Initialize() failed.\n");
-		FBXSDK_printf("Error returned: %s\n\n", Exporter->GetStatus().GetErrorString());
-		return;
+		Manifest << "size = " << Options.TileSize << '\n';
 	}
 
-	// Convert the entire scene back to the fbx coordinate system
+	std::size_t NumFailed = 0;
+	for (const auto& Tile : Tiles)
+	{
+		if (Tile.Failed)
+		{
+			++NumFailed;
+			continue;
+		}
+		Manifest << Tile.Name << " = " << Tile.Name << ".fbx\n";
+	}
+	for (const auto& Tile : Tiles)
+	{
+		if (Tile.Failed)
+		{
+			continue;
+		}
+		const auto& Bounds = Tile.Bounds;
+		Manifest << "\n[" << Tile.Name << "]\n"
+			<< "bbox_min = " << Bounds.x1 << ", " << Bounds.y1 << ", " << Bounds.z1 << '\n'
+			<< "bbox_max = " << Bounds.x2 << ", " << Bounds.y2 << ", " << Bounds.z2 << '\n'
+			<< "visuals = " << Tile.Visuals.size() << '\n'
+			<< "faces = " << Tile.Faces.size() << '\n';
+	}
 
-	FbxAxisSystem(
-		FbxAxisSystem::EUpVector::eYAxis,
-		FbxAxisSystem::EFrontVector::eParityOdd,
-		FbxAxisSystem::ECoordSystem::eRightHanded
-	).DeepConvertScene(Scene);
+	if (!Manifest)
+	{
+		FBXSDK_printf("Can't write tiles manifest '%s'.\n", ManifestName.c_str());
+		return false;
+	}
 
-	Exporter->Export(Scene);
-	Exporter->Destroy();
-	Scene->Destroy();
+	FBXSDK_printf("%zu of %zu level tiles exported\n", Tiles.size() - NumFailed, Tiles.size());
+	return NumFailed == 0;
 }
 
-void FbxStalkerExportLevel(
+bool FbxStalkerExportLevel(
 	FbxManager* SdkManager,
+	const xray_re::xr_file_system& Filesystem,
 	const char* LevelName,
-	const char* XrayPathSpec,
-	const char* TargetPath)
+	const char* TargetPath,
+	const FbxStalkerLevelOptions& Options)
 {
-	xray_re::xr_file_system& Filesystem = xray_re::xr_file_system::instance();
-	if (!Filesystem.initialize(XrayPathSpec))
+	// Only the geometry is exported, so spawns, AI and the rest stay unread.
+	uint32_t LoadMask = xray_re::LL_VISUALS | xray_re::LL_SHADERS | xray_re::LL_CFORM;
+	if (Options.TileBySectors)
 	{
-		FBXSDK_printf("Can't initialize xray path spec.\n");
-		return;
+		LoadMask |= xray_re::LL_SECTORS;
 	}
 
 	xray_re::xr_level Level;
-	if (!Level.load(xray_re::PA_GAME_LEVELS, LevelName))
+	if (!Level.load(xray_re::PA_GAME_LEVELS, LevelName, LoadMask))
 	{
 		FBXSDK_printf("Failed to load game level '%s'.\n", LevelName);
-		return;
+		return false;
+	}
+
+	if (Options.TileSize > 0 || Options.TileBySectors)
+	{
+		return FbxStalkerExportLevelTiles(Filesystem, Level, LevelName, TargetPath, Options);
 	}
 
 	FbxScene* Scene = FbxStalkerBeginExportScene(SdkManager, LevelName);
 	if (!Scene)
 	{
 		FBXSDK_printf("Failed to create FBX level '%s'.\n", LevelName);
-		return;
+		return false;
 	}
 
+	std::vector<std::size_t> OgfIds(Level.visuals()->ogfs().size());
+	std::iota(OgfIds.begin(), OgfIds.end(), 0);
+
 	FbxStalkerExportLevelMaterials(Filesystem, Level.shaders(), Scene);
-	FbxStalkerExportLevelVisuals(Level.visuals(), Level.shaders(), Scene);
-	FbxStalkerExportLevelCollision(Level.cform(), Scene);
+	if (Options.MergeByMaterial)
+	{
+		FbxStalkerExportMergedLevelVisuals(Level.visuals(), Level.shaders(), OgfIds, Options, 0, Scene);
+	}
+	else
+	{
+		FbxStalkerExportLevelVisuals(Level.visuals(), Level.shaders(), OgfIds, Options.SwiLod, Scene);
+	}
+
+	if (Level.cform())
+	{
+		std::vector<std::size_t> FaceIds(Level.cform()->faces().size());
+		std::iota(FaceIds.begin(), FaceIds.end(), 0);
+		FbxStalkerExportLevelCollision(Level.cform(), FaceIds, Scene);
+	}
 
-	FbxStalkerEndExportScene(SdkManager, TargetPath, Scene);
+	return FbxStalkerEndExportScene(SdkManager, TargetPath, Scene);
 }
 
-void FbxStalkerExportActor(
-	FbxManager* SdkManager,
+// Writes each selected motion to its own <actor>@<motion>.fbx holding
+// just the skeleton and one anim stack. Files are written concurrently,
+// every worker with an SDK manager of its own. <actor>.motions.ltx maps
+// the motions to their files.
+bool FbxStalkerExportSplitMotions(
+	const xray_re::xr_file_system& Filesystem,
+	const xray_re::xr_ogf* Ogf,
 	const char* ActorName,
-	const char* XrayPathSpec,
 	const char* TargetPath,
-	FbxStalkerMotionsExportType ExportType)
+	const FbxStalkerMotionOptions& Options)
 {
-	xray_re::xr_file_system& Filesystem = xray_re::xr_file_system::instance();
-	if (!Filesystem.initialize(XrayPathSpec))
+	FbxStalkerMotionQueue Queue(Options.Streaming);
+	FbxStalkerMotionThreads Threads(Queue);
+	Threads.Run([&]
 	{
-		FBXSDK_printf("Can't initialize xray path spec.\n");
-		return;
+		Queue.Load(Filesystem, Ogf, ActorName, FbxStalkerMotionsExportType::eWithExternalMotions, Options.Filter);
+	});
+
+	for (unsigned WorkerId = 0; WorkerId < xray_re::xr_num_threads(); ++WorkerId)
+	{
+		Threads.Run([&]
+		{
+			FbxManager* SdkManager = FbxStalkerCreateManager();
+			while (auto Job = Queue.Take(SIZE_MAX))
+			{
+				const auto* Motion = Queue.Decode(*Job);
+				FbxStalkerMotionKeys Keys;
+				FbxStalkerBakeMotion(Motion, Options, Keys);
+				Queue.Release(*Job);
+
+				bool Result = false;
+				if (FbxScene* Scene = FbxStalkerBeginExportScene(SdkManager, Job->FileName.c_str()))
+				{
+					FbxStalkerBoneTable BoneTable;
+					if (FbxNode* Skeleton = FbxStalkerExportSkeleton(Ogf->bones(), Scene, BoneTable))
+					{
+						Scene->GetRootNode()->AddChild(Skeleton);
+						FbxStalkerWriteMotion(Motion, Keys, BoneTable, Options, Scene);
+						Result = FbxStalkerEndExportScene(SdkManager, TargetPath, Scene);
+					}
+					else
+					{
+						Scene->Destroy();
+					}
+				}
+				if (!Result)
+				{
+					FBXSDK_printf("Failed to export motion '%s'.\n", Motion->name().c_str());
+				}
+				Job->Failed = !Result;
+				Queue.Done(*Job);
+			}
+			SdkManager->Destroy();
+		});
+	}
+	Threads.Join();
+
+	std::string ManifestName = TargetPath;
+	xray_re::xr_file_system::append_path_separator(ManifestName);
+	ManifestName.append(ActorName).append(".motions.ltx");
+	xray_re::xr_file_system::normalize_path(ManifestName);
+
+	std::ofstream Manifest(ManifestName);
+	Manifest << "[skeleton]\nfile = " << ActorName << ".fbx\n\n[motions]\n";
+
+	// The first motion of a name is the one the engine finds, so a later
+	// one of the same name keeps its file but gets no entry.
+	std::set<std::string> MotionNames;
+	std::size_t NumFailed = 0;
+	for (const auto& Job : Queue.GetJobs())
+	{
+		if (Job.Failed)
+		{
+			++NumFailed;
+			continue;
+		}
+		if (!MotionNames.insert(Job.Motion->name()).second)
+		{
+			FBXSDK_printf("Motion '%s' is exported more than once, only its first file is listed.\n",
+				Job.Motion->name().c_str());
+			continue;
+		}
+		Manifest << Job.Motion->name() << " = " << Job.FileName << ".fbx\n";
+	}
+
+	if (!Manifest)
+	{
+		FBXSDK_printf("Can't write motions manifest '%s'.\n", ManifestName.c_str());
+		return false;
 	}
 
+	FBXSDK_printf("%zu of %zu motions exported to separate files\n",
+		Queue.GetJobs().size() - NumFailed, Queue.GetJobs().size());
+	return NumFailed == 0;
+}
+
+bool FbxStalkerExportActor(
+	FbxManager* SdkManager,
+	const xray_re::xr_file_system& Filesystem,
+	const char* ActorName,
+	const char* TargetPath,
+	FbxStalkerMotionsExportType ExportType,
+	const FbxStalkerMotionOptions& MotionOptions)
+{
 	std::string VisualPath;
 	Filesystem.resolve_path(xray_re::PA_GAME_MESHES, ActorName, VisualPath);
-	const auto Ogf = xray_re::xr_ogf::load_ogf(VisualPath + ".ogf");
+	std::unique_ptr<xray_re::xr_ogf> Ogf(xray_re::xr_ogf::load_ogf(VisualPath + ".ogf"));
 	if (!Ogf)
 	{
 		FBXSDK_printf("Can't load game visual '%s'\n", VisualPath.c_str());
-		return;
+		return false;
 	}
 
 	const auto Name = FbxStalkerGetBaseFilename(ActorName);
@@ -755,45 +2001,376 @@ void FbxStalkerExportActor(
 	if (!Scene)
 	{
 		FBXSDK_printf("Failed to create FBX actor '%s'.\n", Name.Buffer());
-		return;
+		return false;
 	}
 
+	FbxStalkerBoneTable BoneTable;
+
 	if (ExportType != FbxStalkerMotionsExportType::eExternalMotionsOnly)
 	{
-		FbxStalkerExportSkinnedVisuals(Filesystem, Ogf, Scene);
+		FbxStalkerExportSkinnedVisuals(Filesystem, Ogf.get(), Scene, BoneTable);
+	}
+
+	if (ExportType == FbxStalkerMotionsExportType::eSplitMotions)
+	{
+		return FbxStalkerEndExportScene(SdkManager, TargetPath, Scene) &&
+			FbxStalkerExportSplitMotions(Filesystem, Ogf.get(), Name.Buffer(), TargetPath, MotionOptions);
 	}
 
 	if (ExportType != FbxStalkerMotionsExportType::eWitoutMotions)
 	{
-		FbxStalkerExportMotions(Filesystem, Ogf, Scene, ExportType);
+		FbxStalkerExportMotions(Filesystem, Ogf.get(), Scene, BoneTable, ExportType, MotionOptions);
 	}
 
-	FbxStalkerEndExportScene(SdkManager, TargetPath, Scene);
+	return FbxStalkerEndExportScene(SdkManager, TargetPath, Scene);
 }
 
-} // anonymous namespace
+enum class FbxStalkerAssetType
+{
+	eActor,
+	eLevel
+};
 
-int main()
+struct FbxStalkerAsset
 {
-	FbxManager* SdkManager = FbxManager::Create();
-	FbxIOSettings* IOSettings = FbxIOSettings::Create(SdkManager, IOSROOT);
-	IOSettings->SetBoolProp(EXP_FBX_EMBEDDED, IOSEnabled);
-	SdkManager->SetIOSettings(IOSettings);
+	FbxStalkerAssetType Type;
+	std::string Name;
+	FbxStalkerMotionsExportType MotionsExportType;
+};
+
+bool FbxStalkerParseMotionsExportType(
+	const std::string& Value,
+	FbxStalkerMotionsExportType& ExportType)
+{
+	if (Value == "none")
+	{
+		ExportType = FbxStalkerMotionsExportType::eWitoutMotions;
+	}
+	else if (Value == "internal")
+	{
+		ExportType = FbxStalkerMotionsExportType::eWithInternalMotions;
+	}
+	else if (Value == "external")
+	{
+		ExportType = FbxStalkerMotionsExportType::eWithExternalMotions;
+	}
+	else if (Value == "only")
+	{
+		ExportType = FbxStalkerMotionsExportType::eExternalMotionsOnly;
+	}
+	else if (Value == "split")
+	{
+		ExportType = FbxStalkerMotionsExportType::eSplitMotions;
+	}
+	else
+	{
+		FBXSDK_printf("Unknown motions export type '%s'.\n", Value.c_str());
+		return false;
+	}
 
-	// FIXME: must be replaced with if-else statement when command line parser will be present
-#if 0
-	FbxStalkerExportLevel(
-		SdkManager,
-		"l11_pripyat", "D:\\projects\\stalker\\fsgame.ltx",
-		"D:\\Projects\\fbxgame");
+	return true;
+}
+
+// Manifest lines are "actor <name> [<motions>]" or "level <name>",
+// empty lines and lines starting with '#' or ';' are skipped.
+bool FbxStalkerLoadManifest(
+	const char* Path,
+	FbxStalkerMotionsExportType DefaultExportType,
+	std::vector<FbxStalkerAsset>& Assets)
+{
+	std::ifstream Manifest(Path);
+	if (!Manifest)
+	{
+		FBXSDK_printf("Can't open manifest '%s'.\n", Path);
+		return false;
+	}
+
+	std::string Line;
+	for (int LineNo = 1; std::getline(Manifest, Line); ++LineNo)
+	{
+		std::istringstream Fields(Line);
+		std::string Type, Name, Motions;
+		if (!(Fields >> Type) || Type[0] == '#' || Type[0] == ';')
+		{
+			continue;
+		}
+
+		FbxStalkerAsset Asset = { FbxStalkerAssetType::eActor, std::string(), DefaultExportType };
+		if (Type == "level")
+		{
+			Asset.Type = FbxStalkerAssetType::eLevel;
+		}
+		else if (Type != "actor")
+		{
+			FBXSDK_printf("%s:%d: unknown asset type '%s'.\n", Path, LineNo, Type.c_str());
+			return false;
+		}
+
+		if (!(Fields >> Asset.Name))
+		{
+			FBXSDK_printf("%s:%d: missing asset name.\n", Path, LineNo);
+			return false;
+		}
+
+		if ((Fields >> Motions) && !FbxStalkerParseMotionsExportType(Motions, Asset.MotionsExportType))
+		{
+			return false;
+		}
+
+		Assets.push_back(Asset);
+	}
+
+	return true;
+}
+
+// Peak resident set size of the process so far, in bytes; 0 if unknown.
+std::size_t FbxStalkerGetPeakRss()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS Counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &Counters, sizeof(Counters)))
+	{
+		return Counters.PeakWorkingSetSize;
+	}
 #else
-	FbxStalkerExportActor(
-		SdkManager,
-		"actors\\trader\\trader",
-		"D:\\projects\\stalker\\fsgame.ltx",
-		"D:\\Projects\\fbxgame",
-		FbxStalkerMotionsExportType::eWithExternalMotions);
+	struct rusage Usage;
+	if (getrusage(RUSAGE_SELF, &Usage) == 0)
+	{
+		return static_cast<std::size_t>(Usage.ru_maxrss) * 1024;	// KiB on Linux
+	}
+#endif
+	return 0;
+}
+
+void FbxStalkerPrintUsage()
+{
+	FBXSDK_printf(
+		"usage: FbxStalkerExporter -fs <fsgame.ltx> -out <folder> [options] <assets>\n"
+		"options:\n"
+		"  -motions <none|internal|external|only|split>  motions export for the following actors\n"
+		"                      (default: external); split writes the mesh and every motion to\n"
+		"                      separate files, listed in <actor>.motions.ltx\n"
+		"  -motion <name>      export only this motion, may be repeated\n"
+		"  -motion-regex <re>  export only motions whose whole name matches <re>\n"
+		"  -reduce-keys <m>,<deg>  drop motion keys that linear interpolation reproduces\n"
+		"                      within these translation and rotation tolerances\n"
+		"  -omf-cache <MiB>    memory budget of the shared motion cache (default: 512)\n"
+		"  -stream-motions     load one OMF at a time past the cache and free it once its\n"
+		"                      motions are exported, bounding memory by the largest OMF\n"
+		"  -merge-level <max verts>  merge level visuals into one mesh per material, split\n"
+		"                      beyond <max verts> vertices (0: no limit)\n"
+		"  -tiles <size|sectors>  write levels as one FBX per <size> metre XZ cell or per\n"
+		"                      sector, listed in <level>.tiles.ltx\n"
+		"  -swi-lod <n>        export progressive level visuals at SWI level of detail <n>\n"
+		"                      (default: 0, the finest; larger ones are clamped)\n"
+		"assets:\n"
+		"  -actor <name>       export a game visual, e.g. actors\\trader\\trader\n"
+		"  -level <name>       export a game level, e.g. l11_pripyat\n"
+		"  -batch <manifest>   export every asset listed in the manifest\n");
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	const char* XrayPathSpec = nullptr;
+	const char* TargetPath = nullptr;
+	FbxStalkerMotionsExportType ExportType = FbxStalkerMotionsExportType::eWithExternalMotions;
+	std::vector<FbxStalkerAsset> Assets;
+	FbxStalkerMotionOptions MotionOptions;
+	FbxStalkerLevelOptions LevelOptions;
+
+	for (int ArgId = 1; ArgId < argc; ++ArgId)
+	{
+		const std::string Option = argv[ArgId];
+		if (Option == "-stream-motions")
+		{
+			MotionOptions.Streaming = true;
+			continue;
+		}
+		if (ArgId + 1 == argc)
+		{
+			FBXSDK_printf("Missing value for '%s'.\n", Option.c_str());
+			FbxStalkerPrintUsage();
+			return 1;
+		}
+
+		const char* Value = argv[++ArgId];
+		if (Option == "-fs")
+		{
+			XrayPathSpec = Value;
+		}
+		else if (Option == "-out")
+		{
+			TargetPath = Value;
+		}
+		else if (Option == "-motions")
+		{
+			if (!FbxStalkerParseMotionsExportType(Value, ExportType))
+			{
+				return 1;
+			}
+		}
+		else if (Option == "-motion")
+		{
+			MotionOptions.Filter.allow(Value);
+		}
+		else if (Option == "-motion-regex")
+		{
+			if (!MotionOptions.Filter.set_pattern(Value))
+			{
+				FBXSDK_printf("Bad motion regex '%s'.\n", Value);
+				return 1;
+			}
+		}
+		else if (Option == "-reduce-keys")
+		{
+			if (std::sscanf(Value, "%lf,%lf", &MotionOptions.TranslationTolerance, &MotionOptions.RotationTolerance) != 2 ||
+				MotionOptions.TranslationTolerance < 0 || MotionOptions.RotationTolerance < 0)
+			{
+				FBXSDK_printf("Bad key reduction tolerances '%s'.\n", Value);
+				return 1;
+			}
+			MotionOptions.ReduceKeys = true;
+		}
+		else if (Option == "-omf-cache")
+		{
+			// unsigned long is 32 bits on Windows, so parse wider and
+			// refuse anything that doesn't fit a size_t in bytes.
+			char* End = nullptr;
+			const unsigned long long Budget = std::strtoull(Value, &End, 10);
+			if (!std::isdigit(static_cast<unsigned char>(*Value)) || *End != '\0' ||
+				Budget > (SIZE_MAX >> 20))
+			{
+				FBXSDK_printf("Bad motion cache budget '%s'.\n", Value);
+				return 1;
+			}
+			xray_re::xr_omf_cache::instance().set_budget(static_cast<std::size_t>(Budget) << 20);
+		}
+		else if (Option == "-merge-level")
+		{
+			char* End = nullptr;
+			LevelOptions.MaxMergedVertices = std::strtoul(Value, &End, 10);
+			if (End == Value || *End != '\0')
+			{
+				FBXSDK_printf("Bad vertex limit '%s'.\n", Value);
+				return 1;
+			}
+			LevelOptions.MergeByMaterial = true;
+		}
+		else if (Option == "-tiles")
+		{
+			if (std::strcmp(Value, "sectors") == 0)
+			{
+				LevelOptions.TileBySectors = true;
+			}
+			else
+			{
+				char* End = nullptr;
+				LevelOptions.TileSize = static_cast<float>(std::strtod(Value, &End));
+				if (End == Value || *End != '\0' || !std::isfinite(LevelOptions.TileSize) ||
+					LevelOptions.TileSize <= 0)
+				{
+					FBXSDK_printf("Bad tile size '%s'.\n", Value);
+					return 1;
+				}
+				LevelOptions.TileBySectors = false;
+			}
+		}
+		else if (Option == "-swi-lod")
+		{
+			char* End = nullptr;
+			LevelOptions.SwiLod = static_cast<unsigned>(std::strtoul(Value, &End, 10));
+			if (End == Value || *End != '\0')
+			{
+				FBXSDK_printf("Bad SWI level of detail '%s'.\n", Value);
+				return 1;
+			}
+		}
+		else if (Option == "-actor")
+		{
+			Assets.push_back({ FbxStalkerAssetType::eActor, Value, ExportType });
+		}
+		else if (Option == "-level")
+		{
+			Assets.push_back({ FbxStalkerAssetType::eLevel, Value, ExportType });
+		}
+		else if (Option == "-batch")
+		{
+			if (!FbxStalkerLoadManifest(Value, ExportType, Assets))
+			{
+				return 1;
+			}
+		}
+		else
+		{
+			FBXSDK_printf("Unknown option '%s'.\n", Option.c_str());
+			FbxStalkerPrintUsage();
+			return 1;
+		}
+	}
+
+	if (!XrayPathSpec || !TargetPath || Assets.empty())
+	{
+		FbxStalkerPrintUsage();
+		return 1;
+	}
+
+	// Both the file system and the FBX manager are set up once and shared
+	// by every asset in the run.
+
+	xray_re::xr_file_system& Filesystem = xray_re::xr_file_system::instance();
+	if (!Filesystem.initialize(XrayPathSpec))
+	{
+		FBXSDK_printf("Can't initialize xray path spec.\n");
+		return 1;
+	}
+
+	FbxManager* SdkManager = FbxStalkerCreateManager();
+
+	using FbxStalkerClock = std::chrono::steady_clock;
+	const auto BatchStart = FbxStalkerClock::now();
+	std::size_t NumFailed = 0;
+
+	for (const auto& Asset : Assets)
+	{
+		const auto AssetStart = FbxStalkerClock::now();
+
+		bool Result = false;
+		if (Asset.Type == FbxStalkerAssetType::eLevel)
+		{
+			Result = FbxStalkerExportLevel(SdkManager, Filesystem, Asset.Name.c_str(), TargetPath, LevelOptions);
+		}
+		else
+		{
+			Result = FbxStalkerExportActor(SdkManager, Filesystem, Asset.Name.c_str(), TargetPath, Asset.MotionsExportType, MotionOptions);
+		}
+
+		const std::chrono::duration<double> Elapsed = FbxStalkerClock::now() - AssetStart;
+		FBXSDK_printf("%s '%s' %s in %.3f s, peak RSS %.1f MiB\n",
+			Asset.Type == FbxStalkerAssetType::eLevel ? "level" : "actor",
+			Asset.Name.c_str(),
+			Result ? "exported" : "FAILED",
+			Elapsed.count(),
+			FbxStalkerGetPeakRss() / 1048576.0);
+
+		if (!Result)
+		{
+			++NumFailed;
+		}
+	}
+
+	const std::chrono::duration<double> Elapsed = FbxStalkerClock::now() - BatchStart;
+	FBXSDK_printf("%zu of %zu assets exported in %.3f s, peak RSS %.1f MiB\n",
+		Assets.size() - NumFailed, Assets.size(), Elapsed.count(),
+		FbxStalkerGetPeakRss() / 1048576.0);
+
+	const auto CacheStats = xray_re::xr_omf_cache::instance().stats();
+	FBXSDK_printf("motion cache: %zu hits, %zu misses, %zu evictions, %zu sets (%.1f MiB) cached\n",
+		CacheStats.hits, CacheStats.misses, CacheStats.evictions,
+		CacheStats.entries, CacheStats.bytes / 1048576.0);
 
 	SdkManager->Destroy();
-#endif
+
+	return NumFailed == 0 ? 0 : 1;
 }
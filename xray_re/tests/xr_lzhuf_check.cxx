@@ -0,0 +1,293 @@
+// Round-trip check for xr_lzhuf.
+//
+// Every input is compressed and decompressed once on the main thread, then
+// again from several threads at the same time; all of them must give the
+// same code and decode back to the input. Files given on the command line
+// are added to the built-in synthetic inputs; the compressed chunks of a
+// chunked file (spawns, levels, OGFs) are taken one by one.
+//
+// The code of the built-in inputs must also match digests taken from the
+// original coder, so a match finder change that alters the bitstream shows
+// up here. Last, all inputs are written with w_compressed_chunks() and
+// read back through xr_reader::open_chunk().
+//
+// With -bench, decoding is timed instead: every input of at least 1 KiB is
+// decompressed over and over for half a second and the rate is printed.
+//
+// Build from the repository root:
+//	g++ -std=c++17 -O2 -pthread -Ixray_re -o xr_lzhuf_check
+//		xray_re/tests/xr_lzhuf_check.cxx xray_re/xr_lzhuf.cxx
+//		xray_re/xr_reader.cxx xray_re/xr_writer.cxx xray_re/xr_packet.cxx
+//		xray_re/xr_vector3.cxx xray_re/xr_file_system.cxx
+//		xray_re/xr_file_system_posix.cxx xray_re/xr_log.cxx
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "xr_lzhuf.h"
+#include "xr_reader.h"
+#include "xr_writer.h"
+
+using namespace xray_re;
+
+namespace {
+
+typedef std::vector<uint8_t> buffer;
+
+struct sample {
+	std::string	name;
+	buffer		text;
+	buffer		code;
+};
+
+// FNV-1a digests of the code the original binary-tree coder gives for the
+// built-in inputs.
+const struct {
+	const char*	name;
+	uint64_t	digest;
+} reference_codes[] = {
+	{ "words-0",	0x4d25767f9dce13f5ull },
+	{ "words-1",	0xd80d6caea7dc7eecull },
+	{ "words-2",	0x050da1295c9de175ull },
+	{ "words-3",	0x412efb393352b39cull },
+	{ "words-4",	0x00daca588311b1f3ull },
+	{ "words-5",	0xf7b65a4255b19174ull },
+	{ "noise",	0x27dc3bb9c2adcdefull },
+	{ "words",	0x969ed51c103eafbcull },
+	{ "records",	0x159f4b6c3fca1a63ull },
+	{ "zeroes",	0xf103cee281b3c50cull },
+};
+
+uint64_t digest(const buffer& data)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+	for (buffer::const_iterator it = data.begin(), end = data.end(); it != end; ++it)
+		h = (h ^ *it)*0x100000001b3ull;
+	return h;
+}
+
+uint32_t next_random(uint32_t& seed)
+{
+	seed = seed*1664525u + 1013904223u;
+	return seed >> 8;
+}
+
+// random bytes do not compress, so they exercise the literal path only.
+buffer make_noise(size_t size, uint32_t seed)
+{
+	buffer text(size);
+	for (size_t i = 0; i != size; ++i)
+		text[i] = uint8_t(next_random(seed));
+	return text;
+}
+
+// words from a small dictionary give plenty of matches of all lengths and
+// distances, like the ltx and script data found in the game archives.
+buffer make_words(size_t size, uint32_t seed)
+{
+	static const char* const words[] = {
+		"actor", "bone", "motion", "visual", "stalker", "level", "spawn",
+		"section", "texture", "shader", "vertex", "index", " ", " = ", "\r\n",
+		"[", "]", "0", "1", "2.5", "-1.0", "_", "weapon", "ammo", "outfit",
+	};
+	buffer text;
+	text.reserve(size);
+	while (text.size() < size) {
+		const char* w = words[next_random(seed) % xr_dim(words)];
+		text.insert(text.end(), w, w + std::strlen(w));
+	}
+	text.resize(size);
+	return text;
+}
+
+// vertex-like records: mostly repeated bytes with a few changing ones.
+buffer make_records(size_t size, uint32_t seed)
+{
+	buffer text(size);
+	for (size_t i = 0; i != size; ++i)
+		text[i] = (i % 32) < 24 ? uint8_t(i % 7) : uint8_t(next_random(seed) & 3);
+	return text;
+}
+
+bool load_file(const char* path, buffer& text)
+{
+	FILE* f = std::fopen(path, "rb");
+	if (f == 0)
+		return false;
+	uint8_t block[64*1024];
+	for (size_t n; (n = std::fread(block, 1, sizeof(block), f)) != 0;)
+		text.insert(text.end(), block, block + n);
+	std::fclose(f);
+	return true;
+}
+
+buffer compress(const buffer& text)
+{
+	uint8_t* code;
+	size_t code_size;
+	xr_lzhuf::compress(code, code_size, text.data(), text.size());
+	buffer result(code, code + code_size);
+	std::free(code);
+	return result;
+}
+
+buffer decompress(const buffer& code)
+{
+	uint8_t* text;
+	size_t text_size;
+	xr_lzhuf::decompress(text, text_size, code.data(), code.size());
+	buffer result(text, text + text_size);
+	std::free(text);
+	return result;
+}
+
+// adds the compressed top-level chunks of a chunked file, or the whole
+// file if it has none.
+bool add_file(const char* path, std::vector<sample>& samples)
+{
+	buffer data;
+	if (!load_file(path, data))
+		return false;
+	std::vector<sample> chunks;
+	for (size_t pos = 0; pos != data.size();) {
+		uint32_t header[2];
+		if (data.size() - pos < sizeof(header)) {
+			chunks.clear();
+			break;
+		}
+		std::memcpy(header, &data[pos], sizeof(header));
+		pos += sizeof(header);
+		if (data.size() - pos < header[1]) {
+			chunks.clear();
+			break;
+		}
+		if ((header[0] & xr_reader::CHUNK_COMPRESSED) && header[1] >= 4) {
+			buffer code(&data[pos], &data[pos] + header[1]);
+			std::string name = std::string(path) + '#' + std::to_string(header[0] & ~xr_reader::CHUNK_COMPRESSED);
+			chunks.push_back(sample{name, decompress(code), code});
+		}
+		pos += header[1];
+	}
+	if (chunks.empty())
+		samples.push_back(sample{path, data, buffer()});
+	else
+		samples.insert(samples.end(), chunks.begin(), chunks.end());
+	return true;
+}
+
+int run_bench(std::vector<sample>& samples)
+{
+	typedef std::chrono::steady_clock clock;
+	for (std::vector<sample>::iterator it = samples.begin(), end = samples.end(); it != end; ++it) {
+		if (it->text.size() < 1024)
+			continue;
+		if (it->code.empty())
+			it->code = compress(it->text);
+		size_t count = 0;
+		double elapsed;
+		clock::time_point start = clock::now();
+		do {
+			uint8_t* text;
+			size_t text_size;
+			xr_lzhuf::decompress(text, text_size, it->code.data(), it->code.size());
+			std::free(text);
+			++count;
+			elapsed = std::chrono::duration<double>(clock::now() - start).count();
+		} while (elapsed < 0.5);
+		std::printf("%-24s %10zu -> %10zu  %8.1f MB/s\n", it->name.c_str(),
+				it->text.size(), it->code.size(), double(count)*it->text.size()/elapsed/1e6);
+	}
+	return 0;
+}
+
+} // end of anonymous namespace
+
+int main(int argc, char* argv[])
+{
+	bool bench = false;
+	std::vector<sample> samples;
+	for (size_t size = 0; size != 6; ++size)
+		samples.push_back(sample{"words-" + std::to_string(size), make_words(size, 1), buffer()});
+	samples.push_back(sample{"noise", make_noise(256*1024, 2), buffer()});
+	samples.push_back(sample{"words", make_words(1024*1024, 3), buffer()});
+	samples.push_back(sample{"records", make_records(512*1024, 4), buffer()});
+	samples.push_back(sample{"zeroes", buffer(100*1024, 0), buffer()});
+	for (int i = 1; i < argc; ++i) {
+		if (std::strcmp(argv[i], "-bench") == 0) {
+			bench = true;
+		} else if (!add_file(argv[i], samples)) {
+			std::fprintf(stderr, "can't read %s\n", argv[i]);
+			return 2;
+		}
+	}
+	if (bench)
+		return run_bench(samples);
+
+	unsigned failed = 0;
+	for (std::vector<sample>::iterator it = samples.begin(), end = samples.end(); it != end; ++it) {
+		it->code = compress(it->text);
+		bool ok = decompress(it->code) == it->text;
+		std::printf("%-24s %10zu -> %10zu  %s\n", it->name.c_str(),
+				it->text.size(), it->code.size(), ok ? "ok" : "FAILED");
+		if (!ok)
+			++failed;
+		for (size_t i = 0; i != xr_dim(reference_codes); ++i) {
+			if (it->name == reference_codes[i].name && digest(it->code) != reference_codes[i].digest) {
+				std::printf("%-24s code differs from the reference coder\n", it->name.c_str());
+				++failed;
+			}
+		}
+	}
+
+	// chunks compressed in parallel must come out as if they were written
+	// one by one, and read back as written.
+	xr_memory_writer parallel, serial;
+	parallel.w_compressed_chunks(0, samples.size(), [&](size_t i, xr_writer& w) {
+		w.w_raw(samples[i].text.data(), samples[i].text.size());
+	});
+	for (size_t i = 0; i != samples.size(); ++i)
+		serial.w_compressed_chunk(uint32_t(i), samples[i].text.data(), samples[i].text.size());
+	bool chunks_ok = parallel.size() == serial.size() &&
+			std::memcmp(parallel.data(), serial.data(), serial.size()) == 0;
+	xr_reader r(parallel.data(), parallel.size());
+	for (size_t i = 0; i != samples.size(); ++i) {
+		const buffer& text = samples[i].text;
+		xr_reader* s = r.open_chunk(uint32_t(i));
+		if (s == 0 || s->size() != text.size() || std::memcmp(s->data(), text.data(), text.size()) != 0)
+			chunks_ok = false;
+		r.close_chunk(s);
+	}
+	std::printf("%zu chunks written in parallel: %s\n", samples.size(), chunks_ok ? "ok" : "FAILED");
+	if (!chunks_ok)
+		++failed;
+
+	// every thread walks the samples from a different starting point, so
+	// different inputs are coded at the same time.
+	unsigned num_threads = std::thread::hardware_concurrency();
+	if (num_threads < 4)
+		num_threads = 4;
+	const unsigned num_rounds = 3;
+	std::atomic<unsigned> mismatches(0);
+	std::vector<std::thread> threads;
+	for (unsigned k = 0; k != num_threads; ++k) {
+		threads.emplace_back([&, k]() {
+			for (size_t n = 0, count = num_rounds*samples.size(); n != count; ++n) {
+				const sample& s = samples[(n + k) % samples.size()];
+				if (compress(s.text) != s.code)
+					++mismatches;
+				if (decompress(s.code) != s.text)
+					++mismatches;
+			}
+		});
+	}
+	for (std::vector<std::thread>::iterator it = threads.begin(), end = threads.end(); it != end; ++it)
+		it->join();
+	std::printf("%u threads x %u rounds: %u mismatches\n", num_threads, num_rounds, mismatches.load());
+
+	return failed == 0 && mismatches == 0 ? 0 : 1;
+}
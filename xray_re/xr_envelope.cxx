@@ -1,4 +1,7 @@
 #include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <mutex>
 #include "xr_envelope.h"
 #include "xr_reader.h"
 #include "xr_writer.h"
@@ -44,59 +47,172 @@ void xr_key::save(xr_writer& w) const
 	}
 }
 
-xr_envelope::~xr_envelope()
+// guards lazy creation of key views on shared (const) envelopes.
+static std::mutex g_key_view_mutex;
+
+xr_envelope::~xr_envelope() {}
+
+void xr_envelope::invalidate_key_view()
+{
+	m_key_view.reset();
+}
+
+void xr_envelope::reserve_keys(size_t n)
 {
-	delete_elements(m_keys);
+	m_times.reserve(n);
+	m_values.reserve(n);
+	if (!m_params.empty())
+		m_params.reserve(n);
+}
+
+void xr_envelope::append_key(const xr_key& key)
+{
+	// step keys don't interpolate, so their parameters are never used
+	// (nor saved).
+	if (key.shape != xr_key::SHAPE_STEP && m_params.empty()) {
+		// the first non-baked key, give all the previous ones parameters.
+		xr_key_params step = { xr_key::SHAPE_STEP, 0, 0, 0, { 0, 0, 0, 0 } };
+		m_params.reserve(m_times.capacity());
+		m_params.assign(m_times.size(), step);
+	}
+	m_times.push_back(key.time);
+	m_values.push_back(key.value);
+	if (key.shape == xr_key::SHAPE_STEP) {
+		if (!m_params.empty()) {
+			xr_key_params step = { xr_key::SHAPE_STEP, 0, 0, 0, { 0, 0, 0, 0 } };
+			m_params.push_back(step);
+		}
+	} else {
+		xr_key_params params = { key.shape, key.tension, key.continuity, key.bias,
+				{ key.param[0], key.param[1], key.param[2], key.param[3] } };
+		m_params.push_back(params);
+	}
+	invalidate_key_view();
 }
 
 void xr_envelope::insert_key(xr_key* key)
 {
-	m_keys.push_back(key);
+	append_key(*key);
+	delete key;
 }
 
 void xr_envelope::insert_key(float time, float value)
 {
-	xr_key* key = new xr_key;
-	key->time = time;
-	key->value = value;
-	key->shape = xr_key::SHAPE_STEP;
-	m_keys.push_back(key);
+	m_times.push_back(time);
+	m_values.push_back(value);
+	if (!m_params.empty()) {
+		xr_key_params step = { xr_key::SHAPE_STEP, 0, 0, 0, { 0, 0, 0, 0 } };
+		m_params.push_back(step);
+	}
+	invalidate_key_view();
+}
+
+void xr_envelope::insert_keys(size_t n, const float* times, const float* values)
+{
+	m_times.insert(m_times.end(), times, times + n);
+	m_values.insert(m_values.end(), values, values + n);
+	if (!m_params.empty()) {
+		xr_key_params step = { xr_key::SHAPE_STEP, 0, 0, 0, { 0, 0, 0, 0 } };
+		m_params.insert(m_params.end(), n, step);
+	}
+	invalidate_key_view();
+}
+
+xr_key xr_envelope::key(size_t at) const
+{
+	xr_key key(xr_key::SHAPE_STEP, m_times[at], m_values[at]);
+	if (!m_params.empty()) {
+		const xr_key_params& params = m_params[at];
+		key.shape = params.shape;
+		key.tension = params.tension;
+		key.continuity = params.continuity;
+		key.bias = params.bias;
+		std::copy(params.param, params.param + 4, key.param);
+	}
+	return key;
+}
+
+const xr_key_vec& xr_envelope::keys() const
+{
+	std::lock_guard<std::mutex> lock(g_key_view_mutex);
+	if (!m_key_view) {
+		std::unique_ptr<key_view> view(new key_view);
+		size_t n = num_keys();
+		view->store.reset(new xr_key[n]);
+		view->keys.resize(n);
+		for (size_t i = 0; i != n; ++i) {
+			view->store[i] = key(i);
+			view->keys[i] = &view->store[i];
+		}
+		m_key_view = std::move(view);
+	}
+	return m_key_view->keys;
 }
 
 void xr_envelope::load_1(xr_reader& r)
 {
 	m_behaviour0 = uint8_t(r.r_u32() & UINT8_MAX);
 	m_behaviour1 = uint8_t(r.r_u32() & UINT8_MAX);
-	r.r_seq(r.r_u32(), m_keys, &xr_key::load_1);
+	size_t n = r.r_u32();
+	reserve_keys(num_keys() + n);
+	for (xr_key key; n; --n) {
+		key.load_1(r);
+		append_key(key);
+	}
 }
 
 void xr_envelope::load_2(xr_reader& r)
 {
 	m_behaviour0 = r.r_u8();
 	m_behaviour1 = r.r_u8();
-	r.r_seq(r.r_u16(), m_keys, &xr_key::load_2);
+	size_t n = r.r_u16();
+	reserve_keys(num_keys() + n);
+	for (xr_key key; n; --n) {
+		key.load_2(r);
+		append_key(key);
+	}
 }
 
 void xr_envelope::save(xr_writer& w) const
 {
 	w.w_u8(m_behaviour0);
 	w.w_u8(m_behaviour1);
-	w.w_size_u16(m_keys.size());
-	w.w_seq(m_keys, &xr_key::save);
+	w.w_size_u16(num_keys());
+	for (size_t i = 0, n = num_keys(); i != n; ++i)
+		key(i).save(w);
 }
 
-void xr_envelope::rebuild()
+// stable sort by time through a permutation, so the parallel arrays are
+// moved only once.
+void xr_envelope::sort_keys()
 {
-	auto pred = [](const xr_key* lhs, const xr_key* rhs)
+	const size_t n = num_keys();
+	std::vector<uint32_t> order(n);
+	for (size_t i = 0; i != n; ++i)
+		order[i] = uint32_t(i);
+	std::stable_sort(order.begin(), order.end(), [this](uint32_t lhs, uint32_t rhs)
 	{
-		return lhs->time < rhs->time;
-	};
+		return m_times[lhs] < m_times[rhs];
+	});
+	std::vector<float> times(n), values(n);
+	for (size_t i = 0; i != n; ++i) {
+		times[i] = m_times[order[i]];
+		values[i] = m_values[order[i]];
+	}
+	m_times.swap(times);
+	m_values.swap(values);
+	if (!m_params.empty()) {
+		std::vector<xr_key_params> params(n);
+		for (size_t i = 0; i != n; ++i)
+			params[i] = m_params[order[i]];
+		m_params.swap(params);
+	}
+}
 
-	auto is_twisted = [](xr_key_vec::const_iterator prev,
-		xr_key_vec::const_iterator next)
+void xr_envelope::rebuild()
+{
+	auto is_twisted = [](float ang0, float ang1)
 	{
-		const auto ang0 = (*prev)->value;
-		const auto ang1 = (*next)->value;
 		if (std::fabs(ang0 + ang1) < M_PI / 4) {
 			const auto abs0 = std::fabs(ang0);
 			const auto abs1 = std::fabs(ang1);
@@ -108,11 +224,8 @@ void xr_envelope::rebuild()
 		return false;
 	};
 
-	auto fix_mirrored = [](xr_key_vec::iterator prev,
-		xr_key_vec::iterator next)
+	auto fix_mirrored = [](float& ang0, float& ang1)
 	{
-		const auto ang0 = (*prev)->value;
-		const auto ang1 = (*next)->value;
 		const auto abs0 = std::fabs(ang0);
 		const auto abs1 = std::fabs(ang1);
 
@@ -122,39 +235,43 @@ void xr_envelope::rebuild()
 
 		if (std::abs(abs1 - M_PI) <= FLT_EPSILON) {
 			if (std::signbit(ang0) != std::signbit(ang1)) {
-				(*next)->value *= -1.f;
+				ang1 *= -1.f;
 				return;
 			}
 		}
 
 		if (std::abs(abs0 - M_PI) <= FLT_EPSILON) {
 			if (std::signbit(ang0) != std::signbit(ang1)) {
-				(*prev)->value *= -1.f;
+				ang0 *= -1.f;
 			}
 		}
 	};
 
-	auto reverse_keys = [](xr_key_vec::iterator begin,
-		xr_key_vec::iterator end)
+	auto reverse_keys = [](float* begin, float* end)
 	{
 		for (auto it = begin; it != end; ++it) {
-			if (std::signbit((*it)->value)) {
-				(*it)->value += static_cast<float>(M_PI * 2);
+			if (std::signbit(*it)) {
+				*it += static_cast<float>(M_PI * 2);
 			}
 			else {
-				(*it)->value -= static_cast<float>(M_PI * 2);
+				*it -= static_cast<float>(M_PI * 2);
 			}
 		}
 	};
 
-	std::stable_sort(m_keys.begin(), m_keys.end(), pred);
+	invalidate_key_view();
+
+	const size_t n = num_keys();
+	if (!std::is_sorted(m_times.begin(), m_times.end()))
+		sort_keys();
 
-	if (m_type == ROTATION) {
-		auto prev = m_keys.begin();
-		for (auto it = prev; it != m_keys.end(); ++it) {
-			fix_mirrored(prev, it);
-			if (is_twisted(prev, it)) {
-				reverse_keys(it, m_keys.end());
+	if (m_type == ROTATION && n != 0) {
+		float* values_p = m_values.data();
+		size_t prev = 0;
+		for (size_t it = prev; it != n; ++it) {
+			fix_mirrored(values_p[prev], values_p[it]);
+			if (is_twisted(values_p[prev], values_p[it])) {
+				reverse_keys(values_p + it, values_p + n);
 			}
 			prev = it;
 		}
@@ -4,7 +4,7 @@
 #ifndef __XR_ENVELOPE_H__
 #define __XR_ENVELOPE_H__
 
-#include<memory>
+#include <memory>
 #include <string>
 #include <vector>
 #include "xr_types.h"
@@ -50,6 +50,18 @@ inline xr_key::xr_key(shape_type _shape, float _time, float _value):
 	std::uninitialized_fill_n(param, xr_dim(param), 0.f);
 }
 
+// Interpolation parameters of a key. Baked keys (SHAPE_STEP without any
+// parameters) don't store them at all.
+struct xr_key_params {
+	uint8_t		shape;
+	float		tension;
+	float		continuity;
+	float		bias;
+	float		param[4];
+};
+
+// Keys are kept as parallel time/value arrays, so an envelope costs a
+// couple of allocations no matter how many keys it has.
 class xr_envelope {
 public:
 	enum type {
@@ -66,9 +78,20 @@ public:
 	void		save(xr_writer& w) const;
 	float		evaluate(float time) const;
 
+	void		reserve_keys(size_t n);
 	void		insert_key(float time, float value);
 	void		insert_key(xr_key* key);
+	void		insert_keys(size_t n, const float* times, const float* values);
+
+	size_t			num_keys() const;
+	const float*		times() const;
+	const float*		values() const;
+	// empty for baked envelopes, one entry per key otherwise.
+	const std::vector<xr_key_params>&	params() const;
+	xr_key			key(size_t at) const;
 
+	// compatibility view, built on the first call and dropped whenever
+	// the keys change. Prefer times()/values().
 	const xr_key_vec&	keys() const;
 	uint8_t&		pre_behaviour();
 	uint8_t			pre_behaviour() const;
@@ -87,14 +110,29 @@ public:
 	};
 
 protected:
-	xr_key_vec	m_keys;
+	void		append_key(const xr_key& key);
+	void		sort_keys();
+	void		invalidate_key_view();
+
+	struct key_view {
+		std::unique_ptr<xr_key[]>	store;
+		xr_key_vec			keys;
+	};
+
+	std::vector<float>		m_times;
+	std::vector<float>		m_values;
+	std::vector<xr_key_params>	m_params;
+	mutable std::unique_ptr<key_view>	m_key_view;
 	uint8_t		m_behaviour0;
 	uint8_t		m_behaviour1;
 	type		m_type;
 };
 
 inline xr_envelope::xr_envelope(xr_envelope::type t): m_behaviour0(BEH_CONSTANT), m_behaviour1(BEH_CONSTANT), m_type(t) {}
-inline const xr_key_vec& xr_envelope::keys() const { return m_keys; }
+inline size_t xr_envelope::num_keys() const { return m_times.size(); }
+inline const float* xr_envelope::times() const { return m_times.data(); }
+inline const float* xr_envelope::values() const { return m_values.data(); }
+inline const std::vector<xr_key_params>& xr_envelope::params() const { return m_params; }
 inline uint8_t& xr_envelope::pre_behaviour() { return m_behaviour0; }
 inline uint8_t xr_envelope::pre_behaviour() const { return m_behaviour0; }
 inline uint8_t& xr_envelope::post_behaviour() { return m_behaviour1; }
@@ -11,6 +11,7 @@ and channels at arbitrary times, which is what plug-ins should use.
 This code shows how to evaluate envelopes in standalone programs.
 ====================================================================== */
 
+#include <algorithm>
 #include "xr_envelope.h"
 #include "xr_math.h"
 
@@ -180,107 +181,111 @@ static float incoming(const xr_key* key0, const xr_key* key1, const xr_key* key1
 
 float xr_envelope::evaluate(float time) const
 {
-	if (m_keys.empty())
+	size_t n = num_keys();
+	if (n == 0)
 		return 0.f;
 
-	if (m_keys.size() == 1)
-		return m_keys.front()->value;
+	if (n == 1)
+		return m_values.front();
 
 	int noff;
 	float offset = 0;
 
-	xr_key* skey = m_keys.front();
-	xr_key* ekey = m_keys.back();
-	if (time < skey->time) {
+	xr_key skey = key(0);
+	xr_key ekey = key(n - 1);
+	if (time < skey.time) {
 		switch (m_behaviour0) {
 		case BEH_RESET:
 			return 0.f;
 
 		case BEH_CONSTANT:
-			return skey->value;
+			return skey.value;
 
 		case BEH_REPEAT:
-			time = range(time, skey->time, ekey->time);
+			time = range(time, skey.time, ekey.time);
 			break;
 
 		case BEH_OSCILLATE:
-			time = range(time, skey->time, ekey->time, &noff);
+			time = range(time, skey.time, ekey.time, &noff);
 			if (noff % 2)
-				time = ekey->time - skey->time - time;
+				time = ekey.time - skey.time - time;
 			break;
 
 		case BEH_OFFSET:
-			time = range(time, skey->time, ekey->time, &noff);
-			offset = noff*(ekey->value - skey->value);
+			time = range(time, skey.time, ekey.time, &noff);
+			offset = noff*(ekey.value - skey.value);
 			break;
 
 		case BEH_LINEAR: {
-			xr_key* next = m_keys[1];
-			return outgoing(0, skey, next)/(next->time - skey->time)*(time - skey->time) + skey->value;
+			xr_key next = key(1);
+			return outgoing(0, &skey, &next)/(next.time - skey.time)*(time - skey.time) + skey.value;
 			}
 		}
-	} else if (ekey->time < time) {
+	} else if (ekey.time < time) {
 		switch (m_behaviour1) {
 		case BEH_RESET:
 			return 0.f;
 
 		case BEH_CONSTANT:
-			return ekey->value;
+			return ekey.value;
 
 		case BEH_REPEAT:
-			time = range(time, skey->time, ekey->time);
+			time = range(time, skey.time, ekey.time);
 			break;
 
 		case BEH_OSCILLATE:
-			time = range(time, skey->time, ekey->time, &noff);
+			time = range(time, skey.time, ekey.time, &noff);
 			if (noff % 2)
-				time = ekey->time - skey->time - time;
+				time = ekey.time - skey.time - time;
 			break;
 
 		case BEH_OFFSET:
-			time = range(time, skey->time, ekey->time, &noff);
-			offset = noff*(ekey->value - skey->value);
+			time = range(time, skey.time, ekey.time, &noff);
+			offset = noff*(ekey.value - skey.value);
 			break;
 
 		case BEH_LINEAR: {
-			xr_key* prev = *(m_keys.end() - 2);
-			return incoming(prev, ekey, 0)/(ekey->time - prev->time)*(time - ekey->time) + ekey->value;
+			xr_key prev = key(n - 2);
+			return incoming(&prev, &ekey, 0)/(ekey.time - prev.time)*(time - ekey.time) + ekey.value;
 			}
 		}
 	}
 
-	xr_key_vec_cit it = m_keys.begin() + 1;
-	// FIXME: use bisection
-	while ((*it)->time < time)
-		++it;
-	xr_key* key0 = *(it - 1);
-	xr_key* key1 = *it;
+	// first key at or after time, but never the very first one.
+	size_t at = std::lower_bound(m_times.begin() + 1, m_times.end() - 1, time) - m_times.begin();
+	xr_key key0 = key(at - 1);
+	xr_key key1 = key(at);
 
-	if (time == key0->time)
-		return key0->value + offset;
-	else if (time == key1->time)
-		return key1->value + offset;
+	if (time == key0.time)
+		return key0.value + offset;
+	else if (time == key1.time)
+		return key1.value + offset;
 
-	float t = (time - key0->time)/(key1->time - key0->time);
+	float t = (time - key0.time)/(key1.time - key0.time);
 
-	switch (key1->shape) {
+	switch (key1.shape) {
 	case xr_key::SHAPE_TCB:
 	case xr_key::SHAPE_BEZI:
 	case xr_key::SHAPE_HERM: {
-		float out = outgoing(key0 == skey ? 0 : *(it - 2), key0, key1);
-		float in = incoming(key0, key1, key1 == ekey ? 0 : *(it + 1));
+		xr_key prev, next;
+		if (at > 1)
+			prev = key(at - 2);
+		if (at + 1 < n)
+			next = key(at + 1);
+		float out = outgoing(at > 1 ? &prev : 0, &key0, &key1);
+		float in = incoming(&key0, &key1, at + 1 < n ? &next : 0);
 		float h1, h2, h3, h4;
 		hermite(t, &h1, &h2, &h3, &h4);
-		return h1*key0->value + h2*key1->value + h3*out + h4*in + offset;
+		return h1*key0.value + h2*key1.value + h3*out + h4*in + offset;
 	}
 	case xr_key::SHAPE_BEZ2:
-		return bez2(key0, key1, time) + offset;
+		return bez2(&key0, &key1, time) + offset;
 
 	case xr_key::SHAPE_LINE:
-		return key0->value + t*(key1->value - key0->value) + offset;
+		return key0.value + t*(key1.value - key0.value) + offset;
 
 	case xr_key::SHAPE_STEP:
-		return key0->value + offset;
+		return key0.value + offset;
 
 	default:
 		return offset;
@@ -23,7 +23,7 @@ const xr_file_system::path_alias* xr_file_system::find_path_alias(const char* pa
 
 void xr_file_system::append_path_separator(std::string& path)
 {
-	if (!path.empty() && *(path.end()-1) != '\\')
+	if (!path.empty() && *(path.end()-1) != '\\' && *(path.end()-1) != '/')
 		path += '\\';
 }
 
@@ -163,8 +163,12 @@ bool xr_file_system::parse_fs_spec(xr_reader& r)
 					values[i].assign(p, last);
 				p = last + 1;
 				++i;
-				if (p == end || *last != '|')
+				if (p == end || *last != '|') {
+					// leave the line break to next_line(), LF-only specs
+					// would lose their next line otherwise.
+					p = last;
 					break;
+				}
 			}
 			assert(i > 0);
 			if (i < 2)
@@ -189,6 +193,9 @@ bool xr_file_system::parse_fs_spec(xr_reader& r)
 
 bool xr_file_system::initialize(const char* fs_spec, unsigned flags)
 {
+	// start over, so re-initialization doesn't stack the aliases up.
+	delete_elements(m_aliases);
+	m_aliases.clear();
 	if (fs_spec && fs_spec[0] != '\0') {
 		xr_reader* r = r_open(fs_spec);
 		if (r == 0)
@@ -226,6 +233,7 @@ bool xr_file_system::resolve_path(const char* path, const char* name, std::strin
 	full_path = pa->root;
 	if (name)
 		full_path.append(name);
+	normalize_path(full_path);
 	return true;
 }
 
@@ -81,6 +81,7 @@ public:
 	void		update_path(const char* path, const char* root, const char* add);
 
 	static void	append_path_separator(std::string& path);
+	static void	normalize_path(std::string& path);
 	static void	split_path(const std::string& path, std::string* folder = 0,
 					std::string* name = 0, std::string* extension = 0);
 	static void	split_path(const char* path, std::string* folder = 0,
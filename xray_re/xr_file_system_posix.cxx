@@ -1,3 +1,317 @@
+#if !defined(_WIN32)
+
+#include <string>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "xr_file_system_posix.h"
+#include "xr_string_utils.h"
 
 using namespace xray_re;
+
+// game paths and fs specs come with '\\' separators.
+static inline std::string native_path(const char* path)
+{
+	std::string native(path);
+	xr_file_system::normalize_path(native);
+	return native;
+}
+
+static bool read_all(int fd, void* data, size_t size)
+{
+	for (uint8_t* p = static_cast<uint8_t*>(data); size > 0;) {
+		ssize_t n = ::read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= size_t(n);
+	}
+	return true;
+}
+
+static bool write_all(int fd, const void* data, size_t size)
+{
+	for (const uint8_t* p = static_cast<const uint8_t*>(data); size > 0;) {
+		ssize_t n = ::write(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= size_t(n);
+	}
+	return true;
+}
+
+void xr_file_system::normalize_path(std::string& path)
+{
+	for (std::string::iterator it = path.begin(), end = path.end(); it != end; ++it) {
+		if (*it == '\\')
+			*it = '/';
+	}
+}
+
+bool xr_file_system::create_folder(const char* path) const
+{
+	if (read_only()) {
+		dbg("fs_ro: creating folder %s", path);
+		return true;
+	}
+	return mkdir(native_path(path).c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+bool xr_file_system::create_path(const char* path) const
+{
+	if (read_only()) {
+		dbg("fs_ro: creating path %s", path);
+		return true;
+	}
+	std::string temp(native_path(path));
+	for (size_t pos = temp.find('/', 1); pos != std::string::npos; pos = temp.find('/', pos + 1)) {
+		temp[pos] = 0;
+		struct stat st;
+		if (stat(temp.c_str(), &st) != 0) {
+			if (mkdir(temp.c_str(), 0755) != 0 && errno != EEXIST)
+				return false;
+		} else if (!S_ISDIR(st.st_mode)) {
+			return false;
+		}
+		temp[pos] = '/';
+	}
+	return mkdir(temp.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+void xr_file_system::split_path(const char* path, std::string* folder,
+		std::string* name, std::string* extension)
+{
+	// unlike win32, only the extension is lowercased: the file system is
+	// case sensitive, so folder and name must be kept as they are.
+	const char* base = path;
+	for (const char* p = path; *p; ++p) {
+		if (*p == '/' || *p == '\\')
+			base = p + 1;
+	}
+	const char* ext = std::strrchr(base, '.');
+	if (ext == 0)
+		ext = base + std::strlen(base);
+	if (folder)
+		folder->assign(path, base);
+	if (name)
+		name->assign(base, ext);
+	if (extension) {
+		extension->assign(ext);
+		xr_strlwr(*extension);
+	}
+}
+
+bool xr_file_system::folder_exist(const char* path)
+{
+	struct stat st;
+	return stat(native_path(path).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool xr_file_system::file_exist(const char* path)
+{
+	struct stat st;
+	return stat(native_path(path).c_str(), &st) == 0 && !S_ISDIR(st.st_mode);
+}
+
+size_t xr_file_system::file_length(const char* path)
+{
+	struct stat st;
+	if (stat(native_path(path).c_str(), &st) != 0 || S_ISDIR(st.st_mode))
+		return 0;
+	if (uint64_t(st.st_size) > SIZE_MAX)
+		return 0;
+	return size_t(st.st_size);
+}
+
+uint32_t xr_file_system::file_age(const char* path)
+{
+	struct stat st;
+	if (stat(native_path(path).c_str(), &st) == 0)
+		return uint32_t(st.st_mtime);
+	return 0;
+}
+
+bool xr_file_system::copy_file(const char* src_path, const char* tgt_path) const
+{
+	if (read_only()) {
+		dbg("fs_ro: copying %s to %s", src_path, tgt_path);
+		return true;
+	}
+	int src = open(native_path(src_path).c_str(), O_RDONLY|O_CLOEXEC);
+	if (src < 0)
+		return false;
+	struct stat st;
+	if (fstat(src, &st) != 0) {
+		close(src);
+		return false;
+	}
+	int tgt = open(native_path(tgt_path).c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,
+			st.st_mode & 0777);
+	if (tgt < 0) {
+		close(src);
+		return false;
+	}
+	bool done = true;
+	uint8_t buffer[64*1024];
+	for (;;) {
+		ssize_t n = ::read(src, buffer, sizeof(buffer));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			done = n == 0;
+			break;
+		}
+		if (!write_all(tgt, buffer, size_t(n))) {
+			done = false;
+			break;
+		}
+	}
+	close(tgt);
+	close(src);
+	return done;
+}
+
+xr_reader* xr_file_system::r_open(const char* path) const
+{
+	int fd = open(native_path(path).c_str(), O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || uint64_t(st.st_size) > SIZE_MAX) {
+		close(fd);
+		return 0;
+	}
+	size_t len = size_t(st.st_size);
+
+	xr_reader* r = 0;
+
+	// small files are cheaper to read than to map.
+	if (len < size_t(sysconf(_SC_PAGESIZE))) {
+		uint8_t* data = static_cast<uint8_t*>(malloc(len ? len : 1));
+		if (data != 0) {
+			if (read_all(fd, data, len))
+				r = new xr_temp_reader(data, len);
+			else
+				free(data);
+		}
+		close(fd);
+		return r;
+	}
+
+	void* data = mmap(0, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return 0;
+
+	// the loaders walk chunks front to back, so let the kernel read ahead
+	// aggressively and start paging the whole file in right away.
+	madvise(data, len, MADV_SEQUENTIAL);
+	madvise(data, len, MADV_WILLNEED);
+
+	return new xr_mmap_reader_posix(data, len);
+}
+
+xr_writer* xr_file_system::w_open(const char* path, bool ignore_ro) const
+{
+	if (!ignore_ro && read_only()) {
+		dbg("fs_ro: writing %s", path);
+		return new xr_fake_writer();
+	}
+
+	int fd = open(native_path(path).c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	assert(fd >= 0);
+	if (fd < 0)
+		return 0;
+	return new xr_file_writer_posix(fd);
+}
+
+xr_mmap_reader_posix::xr_mmap_reader_posix() {}
+
+xr_mmap_reader_posix::xr_mmap_reader_posix(const void* data, size_t size)
+{
+	m_next = m_p = m_data = static_cast<const uint8_t*>(data);
+	m_end = m_data + size;
+}
+
+xr_mmap_reader_posix::~xr_mmap_reader_posix()
+{
+	assert(m_data != 0);
+	munmap(const_cast<uint8_t*>(m_data), size());
+}
+
+xr_file_writer_posix::xr_file_writer_posix(): m_fd(-1), m_pos(0), m_cursor(0), m_size(0) {}
+
+xr_file_writer_posix::xr_file_writer_posix(int fd): m_fd(fd), m_pos(0), m_cursor(0), m_size(0) {}
+
+xr_file_writer_posix::~xr_file_writer_posix()
+{
+	if (m_fd >= 0) {
+		flush();
+		close(m_fd);
+	}
+}
+
+void xr_file_writer_posix::flush()
+{
+	if (m_size == 0)
+		return;
+	bool ok = write_all(m_fd, m_buffer, m_size);
+	xr_assert(ok);
+	// we may have been seeked back inside the buffer (chunk size patching).
+	if (m_cursor != m_size) {
+		off_t new_pos = lseek(m_fd, off_t(m_pos + m_cursor), SEEK_SET);
+		xr_assert(new_pos == off_t(m_pos + m_cursor));
+	}
+	m_pos += m_cursor;
+	m_cursor = 0;
+	m_size = 0;
+}
+
+void xr_file_writer_posix::w_raw(const void* data, size_t size)
+{
+	if (size >= BUFFER_SIZE) {
+		// the buffer may still hold bytes past the cursor; they go first.
+		flush();
+		bool ok = write_all(m_fd, data, size);
+		xr_assert(ok);
+		m_pos += size;
+		return;
+	}
+	if (m_cursor + size > BUFFER_SIZE)
+		flush();
+	std::memcpy(m_buffer + m_cursor, data, size);
+	m_cursor += size;
+	if (m_size < m_cursor)
+		m_size = m_cursor;
+}
+
+void xr_file_writer_posix::seek(size_t pos)
+{
+	if (pos >= m_pos && pos <= m_pos + m_size) {
+		m_cursor = pos - m_pos;
+		return;
+	}
+	flush();
+	off_t new_pos = lseek(m_fd, off_t(pos), SEEK_SET);
+	xr_assert(new_pos == off_t(pos));
+	m_pos = pos;
+}
+
+size_t xr_file_writer_posix::tell()
+{
+	return m_pos + m_cursor;
+}
+
+#endif // !_WIN32
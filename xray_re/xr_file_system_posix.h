@@ -8,6 +8,36 @@
 
 namespace xray_re {
 
+class xr_mmap_reader_posix: public xr_reader {
+public:
+			xr_mmap_reader_posix();
+			xr_mmap_reader_posix(const void* data, size_t size);
+	virtual		~xr_mmap_reader_posix();
+};
+
+class xr_file_writer_posix: public xr_writer {
+public:
+			xr_file_writer_posix();
+			xr_file_writer_posix(int fd);
+	virtual		~xr_file_writer_posix();
+	virtual void	w_raw(const void* src, size_t src_size);
+	virtual void	seek(size_t pos);
+	virtual size_t	tell();
+
+private:
+	void		flush();
+
+	enum {
+		BUFFER_SIZE	= 64*1024,
+	};
+
+	int		m_fd;
+	size_t		m_pos;		// file offset of m_buffer[0]
+	size_t		m_cursor;	// write position in m_buffer
+	size_t		m_size;		// valid bytes in m_buffer
+	uint8_t		m_buffer[BUFFER_SIZE];
+};
+
 } // end of namespace xray_re
 
 #endif
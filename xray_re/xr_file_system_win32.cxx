@@ -1,3 +1,5 @@
+#if defined(_WIN32)
+
 #include <string>
 #include <cstdlib>
 #include <sys/types.h>
@@ -7,6 +9,14 @@
 
 using namespace xray_re;
 
+void xr_file_system::normalize_path(std::string& path)
+{
+	for (std::string::iterator it = path.begin(), end = path.end(); it != end; ++it) {
+		if (*it == '/')
+			*it = '\\';
+	}
+}
+
 bool xr_file_system::create_folder(const char* path) const
 {
 	if (read_only()) {
@@ -276,3 +286,5 @@ size_t xr_file_writer_win32::tell()
 {
 	return SetFilePointer(m_h, 0, NULL, FILE_CURRENT);
 }
+
+#endif // _WIN32
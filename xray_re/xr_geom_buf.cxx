@@ -1,7 +1,17 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
 #include "xr_geom_buf.h"
 #include "xr_reader.h"
 #include "xr_writer.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XR_GEOM_SSE2 1
+#include <emmintrin.h>
+#else
+#define XR_GEOM_SSE2 0
+#endif
+
 using namespace xray_re;
 
 xr_vbuf::xr_vbuf(): m_signature(0),
@@ -152,6 +162,101 @@ static inline void r_qcolor(xr_reader& r, fcolor& c)
 	c.a = r.r_float_q8(-1.f, 1.f);
 }
 
+// column decoders for load_d3d9(): convert one vertex element of n
+// vertices laid out stride bytes apart.
+enum vertex_column_kind {
+	VC_SKIP,
+	VC_FLOAT3,
+	VC_FLOAT2,
+	VC_QNORMAL,
+	VC_QCOLOR,
+	VC_QTEXCOORD,
+	VC_QTEXCOORD2,
+	VC_QLIGHTMAP,
+};
+
+struct vertex_column {
+	vertex_column_kind	kind;
+	size_t			offset;
+	void*			target;
+};
+
+static void decode_float3(fvector3* dest, const uint8_t* p, size_t stride, size_t n)
+{
+	for (size_t i = 0; i != n; ++i, p += stride)
+		std::memcpy(&dest[i], p, 3*sizeof(float));
+}
+
+static void decode_float2(fvector2* dest, const uint8_t* p, size_t stride, size_t n)
+{
+	for (size_t i = 0; i != n; ++i, p += stride)
+		std::memcpy(&dest[i], p, 2*sizeof(float));
+}
+
+#if XR_GEOM_SSE2
+// four unsigned bytes to (b*k + bias) floats, with the same rounding as
+// r_float_q8().
+static inline __m128 load_q8x4(const uint8_t* p, __m128 k, __m128 bias)
+{
+	int32_t packed;
+	std::memcpy(&packed, p, sizeof(packed));
+	__m128i zero = _mm_setzero_si128();
+	__m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+	return _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(b, zero)), k), bias);
+}
+#endif
+
+static void decode_qnormal(fvector3* dest, const uint8_t* p, size_t stride, size_t n)
+{
+	const float k = 2.f/255.f;
+	size_t i = 0;
+#if XR_GEOM_SSE2
+	// 16-byte stores spill into the next normal, which is rewritten on
+	// the next iteration; the last one is stored separately.
+	const __m128 k4 = _mm_set1_ps(k), bias4 = _mm_set1_ps(-1.f);
+	for (; i + 1 < n; ++i, p += stride)
+		_mm_storeu_ps(&dest[i].x, load_q8x4(p, k4, bias4));
+#endif
+	for (; i != n; ++i, p += stride)
+		dest[i].set(p[0]*k - 1.f, p[1]*k - 1.f, p[2]*k - 1.f);
+}
+
+static void decode_qcolor(fcolor* dest, const uint8_t* p, size_t stride, size_t n)
+{
+	const float k = 2.f/255.f;
+	size_t i = 0;
+#if XR_GEOM_SSE2
+	const __m128 k4 = _mm_set1_ps(k), bias4 = _mm_set1_ps(-1.f);
+	for (; i != n; ++i, p += stride)
+		_mm_storeu_ps(&dest[i].r, load_q8x4(p, k4, bias4));
+#endif
+	for (; i != n; ++i, p += stride)
+		dest[i].set(p[0]*k - 1.f, p[1]*k - 1.f, p[2]*k - 1.f, p[3]*k - 1.f);
+}
+
+// the first two signed shorts of each element scaled by k.
+static void decode_short2(fvector2* dest, const uint8_t* p, size_t stride, size_t n, float k)
+{
+	size_t i = 0;
+#if XR_GEOM_SSE2
+	const __m128 k4 = _mm_set1_ps(k);
+	for (; i + 2 <= n; i += 2, p += 2*stride) {
+		int32_t uv0, uv1;
+		std::memcpy(&uv0, p, sizeof(uv0));
+		std::memcpy(&uv1, p + stride, sizeof(uv1));
+		__m128i uv = _mm_unpacklo_epi32(_mm_cvtsi32_si128(uv0), _mm_cvtsi32_si128(uv1));
+		// sign-extend the shorts by shifting them into the upper halves
+		uv = _mm_srai_epi32(_mm_unpacklo_epi16(uv, uv), 16);
+		_mm_storeu_ps(&dest[i].x, _mm_mul_ps(_mm_cvtepi32_ps(uv), k4));
+	}
+#endif
+	for (; i != n; ++i, p += stride) {
+		int16_t uv[2];
+		std::memcpy(uv, p, sizeof(uv));
+		dest[i].set(uv[0]*k, uv[1]*k);
+	}
+}
+
 void xr_vbuf::load_d3d9(xr_reader& r, size_t n, const d3d_vertex_element ve[], size_t n_ve)
 {
 	clear();
@@ -197,55 +302,120 @@ void xr_vbuf::load_d3d9(xr_reader& r, size_t n, const d3d_vertex_element ve[], s
 		}
 	}
 
-	fvector2 uv_fix;
+	// compile the declaration into a list of column decoders: each one
+	// knows its offset within the vertex and its target array, so the
+	// vertices are decoded one element kind at a time with no per-vertex
+	// dispatch.
+	std::vector<vertex_column> columns;
+	const size_t NONE = ~size_t(0);
+	size_t tangent = NONE, binormal = NONE;
+	size_t stride = 0;
+	unsigned tc = 0;
+	columns.reserve(n_ve);
+	for (size_t i = 0; i != n_ve; ++i) {
+		vertex_column column = { VC_SKIP, stride, 0 };
+		switch (ve[i].usage) {
+		case D3D_VE_USAGE_POSITION:
+			column.kind = VC_FLOAT3;
+			column.target = m_points;
+			stride += 3*sizeof(float);
+			break;
+		case D3D_VE_USAGE_NORMAL:
+			column.kind = VC_QNORMAL;
+			column.target = m_normals;
+			stride += 4*sizeof(uint8_t);
+			break;
+		case D3D_VE_USAGE_TEXCOORD:
+			switch (ve[i].type) {
+			case D3D_VE_TYPE_FLOAT2:
+				column.kind = VC_FLOAT2;
+				column.target = ++tc == 1 ? m_texcoords : m_lightmaps;
+				stride += 2*sizeof(float);
+				break;
+			case D3D_VE_TYPE_SHORT2:
+				if (++tc == 1) {
+					column.kind = VC_QTEXCOORD;
+					column.target = m_texcoords;
+				} else {
+					column.kind = VC_QLIGHTMAP;
+					column.target = m_lightmaps;
+				}
+				stride += 2*sizeof(int16_t);
+				break;
+			default:
+			case D3D_VE_TYPE_SHORT4:
+				column.kind = VC_QTEXCOORD2;
+				column.target = m_texcoords;
+				stride += 4*sizeof(int16_t);
+				break;
+			}
+			break;
+		case D3D_VE_USAGE_TANGENT:
+		case D3D_VE_USAGE_BINORMAL:
+			stride += 4*sizeof(uint8_t);
+			break;
+		case D3D_VE_USAGE_COLOR:
+			column.kind = VC_QCOLOR;
+			column.target = m_colors;
+			stride += 4*sizeof(uint8_t);
+			break;
+		}
+		if (ve[i].usage == D3D_VE_USAGE_TANGENT)
+			tangent = column.offset + 3;
+		else if (ve[i].usage == D3D_VE_USAGE_BINORMAL)
+			binormal = column.offset + 3;
+		columns.push_back(column);
+	}
+
+	xr_assert(n*stride <= r.elapsed());
+	const uint8_t* data = r.pointer<uint8_t>();
 	set_size(n);
-	for (size_t i = 0; i != n; ++i) {
-		unsigned tc = 0;
-		uv_fix.set(0, 0);
-		for (size_t j = 0; j != n_ve; ++j) {
-			switch (ve[j].usage) {
-			case D3D_VE_USAGE_POSITION:
-				r.r_fvector3(m_points[i]);
+	// go in blocks small enough for the source vertices to stay in cache
+	// while every column is pulled out of them.
+	const size_t BLOCK = 256;
+	for (size_t base = 0; base < n; base += BLOCK) {
+		size_t m = std::min(BLOCK, n - base);
+		const uint8_t* block = data + base*stride;
+		for (std::vector<vertex_column>::const_iterator it = columns.begin(),
+				end = columns.end(); it != end; ++it) {
+			const uint8_t* p = block + it->offset;
+			switch (it->kind) {
+			case VC_FLOAT3:
+				decode_float3(static_cast<fvector3*>(it->target) + base, p, stride, m);
 				break;
-			case D3D_VE_USAGE_NORMAL:
-				r_qnormal(r, m_normals[i]);
+			case VC_FLOAT2:
+				decode_float2(static_cast<fvector2*>(it->target) + base, p, stride, m);
 				break;
-			case D3D_VE_USAGE_TEXCOORD:
-				switch (ve[j].type) {
-				case D3D_VE_TYPE_FLOAT2:
-					r.r_fvector2(++tc == 1 ? m_texcoords[i] : m_lightmaps[i]);
-					break;
-				case D3D_VE_TYPE_SHORT2:
-					if (++tc == 1)
-						r_qtexcoord(r, m_texcoords[i]);
-					else
-						r_qlightmap(r, m_lightmaps[i]);
-					break;
-				default:
-				case D3D_VE_TYPE_SHORT4:
-					r_qtexcoord2(r, m_texcoords[i]);
-					r.advance(2*sizeof(int16_t));
-					break;
-				}
+			case VC_QNORMAL:
+				decode_qnormal(static_cast<fvector3*>(it->target) + base, p, stride, m);
+				break;
+			case VC_QCOLOR:
+				decode_qcolor(static_cast<fcolor*>(it->target) + base, p, stride, m);
 				break;
-			case D3D_VE_USAGE_TANGENT:
-				r.advance(3*sizeof(uint8_t));
-				uv_fix.x = r.r_float_q8()*(32.f/32768.f);
+			case VC_QTEXCOORD:
+				decode_short2(static_cast<fvector2*>(it->target) + base, p, stride, m, 32.f/32768.f);
 				break;
-			case D3D_VE_USAGE_BINORMAL:
-				r.advance(3*sizeof(uint8_t));
-				uv_fix.y = r.r_float_q8()*(32.f/32768.f);
+			case VC_QTEXCOORD2:
+				decode_short2(static_cast<fvector2*>(it->target) + base, p, stride, m, 16.f/32768.f);
 				break;
-			case D3D_VE_USAGE_COLOR:
-				r_qcolor(r, m_colors[i]);
+			case VC_QLIGHTMAP:
+				decode_short2(static_cast<fvector2*>(it->target) + base, p, stride, m, 1.f/32768.f);
+				break;
+			case VC_SKIP:
 				break;
 			}
 		}
-		if (m_texcoords) {
-			m_texcoords[i].x += uv_fix.x;
-			m_texcoords[i].y += uv_fix.y;
+		// the 4th byte of the last tangent/binormal holds a fine texcoord offset
+		if (m_texcoords && (tangent != NONE || binormal != NONE)) {
+			for (size_t i = 0; i != m; ++i) {
+				const uint8_t* v = block + i*stride;
+				fvector2& uv = m_texcoords[base + i];
+				uv.x += tangent == NONE ? 0 : v[tangent]*(1.f/255.f)*(32.f/32768.f);
+				uv.y += binormal == NONE ? 0 : v[binormal]*(1.f/255.f)*(32.f/32768.f);
+			}
 		}
 	}
+	r.advance(n*stride);
 	make_signature();
 }
 
@@ -521,6 +691,7 @@ void xr_swibuf::load(xr_reader& r)
 	xr_assert(n > 0);
 	m_slide_windows = new ogf4_slide_window[n];
 	r.r_cseq(n, m_slide_windows, read_sw());
+	set_size(n);
 }
 
 struct write_sw { void operator()(const ogf4_slide_window& sw, xr_writer& w) const {
@@ -1,5 +1,6 @@
 #define NOMINMAX
 #include <climits>
+#include <cstring>
 //#include <nvimage/Image.h>
 //#include <nvimage/DirectDrawSurface.h>
 //#include <nvmath/Color.h>
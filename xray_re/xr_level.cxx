@@ -81,7 +81,7 @@ xr_level::~xr_level()
 	delete m_gamemtls_lib;
 }
 
-bool xr_level::load(const char* game_data_path, const char* level_path)
+bool xr_level::load(const char* game_data_path, const char* level_path, uint32_t mask)
 {
 	char level[1024];
 	std::snprintf(level, sizeof(level), "%s\\level", level_path);
@@ -105,7 +105,7 @@ bool xr_level::load(const char* game_data_path, const char* level_path)
 		case XRLC_VERSION_13:
 		case XRLC_VERSION_14:
 			r->debug_find_chunk();
-			load(xrlc_version, game_data_path, level_path, *r);
+			load(xrlc_version, game_data_path, level_path, *r, mask);
 			status = true;
 			break;
 		default:
@@ -147,7 +147,8 @@ template<> xr_image* load(const char* path, const char* name, bool required)
 	return 0;
 }
 
-void xr_level::load(uint32_t xrlc_version, const char* game_data_path, const char* level_path, xr_reader& r)
+void xr_level::load(uint32_t xrlc_version, const char* game_data_path, const char* level_path,
+		xr_reader& r, uint32_t mask)
 {
 	std::string full_path;
 	xr_file_system& fs = xr_file_system::instance();
@@ -157,46 +158,69 @@ void xr_level::load(uint32_t xrlc_version, const char* game_data_path, const cha
 	}
 	level_path = full_path.c_str();
 
-	m_ltx = ::load<xr_level_ltx>(level_path, "level.ltx", true);
+	// pull in what the requested parts are built from.
+	if (mask & LL_VISUALS)
+		mask |= LL_GEOM;
+	if (mask & LL_BRKBL_MESHES)
+		mask |= LL_SPAWN;
+	if ((mask & LL_SND_STATIC) && xrlc_version < XRLC_VERSION_13)
+		mask |= LL_LTX;
 
-	if (xrlc_version == XRLC_VERSION_12) {
+	if (mask & LL_LTX)
+		m_ltx = ::load<xr_level_ltx>(level_path, "level.ltx", true);
+
+	if ((mask & LL_GEOM) && xrlc_version == XRLC_VERSION_12) {
 		m_geom = ::load<xr_level_geom>(level_path, "level", true);
 	}
 
-	if (xrlc_version >= XRLC_VERSION_13) {
+	if ((mask & LL_GEOM) && xrlc_version >= XRLC_VERSION_13) {
 		m_geom = ::load<xr_level_geom>(level_path, "level.geom", true);
 //		m_geomx = ::load<xr_level_geom>(level_path, "level.geomx");
 	}
 	msg("loading %s", "level");
-	if (xrlc_version <= XRLC_VERSION_9) {
+	if ((mask & LL_GEOM) && xrlc_version <= XRLC_VERSION_9) {
 		msg("...geom");
 		m_geom = new xr_level_geom(xrlc_version, r);
 	}
-	msg("...visuals");
-	m_visuals = new xr_level_visuals(xrlc_version, r, m_geom);
-	msg("...shaders/textures");
-	m_shaders = new xr_level_shaders(xrlc_version, r);
+	if (mask & LL_VISUALS) {
+		msg("...visuals");
+		m_visuals = new xr_level_visuals(xrlc_version, r, m_geom);
+	}
+	if (mask & LL_SHADERS) {
+		msg("...shaders/textures");
+		m_shaders = new xr_level_shaders(xrlc_version, r);
+	}
 
-	msg("...sectors");
-	m_sectors = new xr_level_sectors(xrlc_version, r);
-	msg("...portals");
-	m_portals = new xr_level_portals(xrlc_version, r);
+	if (mask & LL_SECTORS) {
+		msg("...sectors");
+		m_sectors = new xr_level_sectors(xrlc_version, r);
+	}
+	if (mask & LL_PORTALS) {
+		msg("...portals");
+		m_portals = new xr_level_portals(xrlc_version, r);
+	}
 
-	msg("...lights");
-	m_lights = new xr_level_lights(xrlc_version, r);
-	msg("...glows");
-	m_glows = new xr_level_glows(xrlc_version, r);
+	if (mask & LL_LIGHTS) {
+		msg("...lights");
+		m_lights = new xr_level_lights(xrlc_version, r);
+	}
+	if (mask & LL_GLOWS) {
+		msg("...glows");
+		m_glows = new xr_level_glows(xrlc_version, r);
+	}
 
-	if (xrlc_version <= XRLC_VERSION_9) {
+	if ((mask & LL_CFORM) && xrlc_version <= XRLC_VERSION_9) {
 		msg("...cform");
 		m_cform = new xr_level_cform(xrlc_version, r);
-	} else {
+	} else if (mask & LL_CFORM) {
 		m_cform = ::load<xr_level_cform>(level_path, "level.cform", true);
 	}
 
-	m_hom = ::load<xr_level_hom>(level_path, "level.hom");
+	if (mask & LL_HOM)
+		m_hom = ::load<xr_level_hom>(level_path, "level.hom");
 
-	m_details = ::load<xr_level_details>(level_path, "level.details");
+	if (mask & LL_DETAILS)
+		m_details = ::load<xr_level_details>(level_path, "level.details");
 	if (m_details && xrlc_version == XRLC_VERSION_12) {
 		msg("...texture");
 		m_details->load_texture(level_path);
@@ -207,65 +231,47 @@ void xr_level::load(uint32_t xrlc_version, const char* game_data_path, const cha
 		m_details->load_texture(level_path);
 	}
 
-	if (xrlc_version == XRLC_VERSION_12) {
-		m_ai = ::load<xr_level_ai>(level_path, "level.ai");
-		m_game = ::load<xr_level_game>(level_path, "level.game");
-		m_spawn = ::load<xr_level_spawn>(level_path, "level.spawn");
+	if (xrlc_version >= XRLC_VERSION_12) {
+		if (mask & LL_AI)
+			m_ai = ::load<xr_level_ai>(level_path, "level.ai");
+		if (mask & LL_GAME)
+			m_game = ::load<xr_level_game>(level_path, "level.game");
+		if (mask & LL_SPAWN)
+			m_spawn = ::load<xr_level_spawn>(level_path, "level.spawn");
 
-		m_wallmarks = ::load<xr_level_wallmarks>(level_path, "level.wallmarks");
+		if (mask & LL_WALLMARKS)
+			m_wallmarks = ::load<xr_level_wallmarks>(level_path, "level.wallmarks");
 
-		m_som = ::load<xr_level_som>(level_path, "level.som");
-		m_snd_env = ::load<xr_level_snd_env>(level_path, "level.snd_env");
-		m_snd_static = ::load<xr_level_snd_static>(level_path, "level.snd_static");
+		if (mask & LL_SOM)
+			m_som = ::load<xr_level_som>(level_path, "level.som");
+		if (mask & LL_SND_ENV)
+			m_snd_env = ::load<xr_level_snd_env>(level_path, "level.snd_env");
+		if (mask & LL_SND_STATIC)
+			m_snd_static = ::load<xr_level_snd_static>(level_path, "level.snd_static");
 
-		m_ps_static = ::load<xr_level_ps_static>(level_path, "level.ps_static");
+		if (mask & LL_PS_STATIC)
+			m_ps_static = ::load<xr_level_ps_static>(level_path, "level.ps_static");
 
-		m_env_mod = ::load<xr_level_env_mod>(level_path, "level.env_mod");
+		if (mask & LL_ENV_MOD)
+			m_env_mod = ::load<xr_level_env_mod>(level_path, "level.env_mod");
 
-		m_fog_vol = ::load<xr_level_fog_vol>(level_path, "level.fog_vol");
-	} if (xrlc_version >= XRLC_VERSION_13) {
-		m_ai = ::load<xr_level_ai>(level_path, "level.ai");
-		m_game = ::load<xr_level_game>(level_path, "level.game");
-		m_spawn = ::load<xr_level_spawn>(level_path, "level.spawn");
-
-		m_wallmarks = ::load<xr_level_wallmarks>(level_path, "level.wallmarks");
-
-		m_som = ::load<xr_level_som>(level_path, "level.som");
-		m_snd_env = ::load<xr_level_snd_env>(level_path, "level.snd_env");
-		m_snd_static = ::load<xr_level_snd_static>(level_path, "level.snd_static");
-
-		m_ps_static = ::load<xr_level_ps_static>(level_path, "level.ps_static");
-
-		m_env_mod = ::load<xr_level_env_mod>(level_path, "level.env_mod");
-
-		m_fog_vol = ::load<xr_level_fog_vol>(level_path, "level.fog_vol");
-
-		if (xrlc_version >= XRLC_VERSION_14)
+		if (mask & LL_FOG_VOL)
+			m_fog_vol = ::load<xr_level_fog_vol>(level_path, "level.fog_vol");
+	}
+	if (xrlc_version >= XRLC_VERSION_13) {
+		if ((mask & LL_BUILD_LIGHTS) && xrlc_version >= XRLC_VERSION_14)
 			m_build_lights = ::load<xr_build_lights>(level_path, "build.lights");
-	} else {
+	} else if (mask & LL_SND_STATIC) {
+		delete m_snd_static;
 		m_snd_static = new xr_level_snd_static(*m_ltx->ini());
 	}
 
-	m_lods = ::load<xr_image>(level_path, "level_lods.dds");
-	m_lods_nm = ::load<xr_image>(level_path, "level_lods_nm.dds");
-
-	if (m_spawn && xrlc_version == XRLC_VERSION_12) {
-		for (xr_entity_vec_cit it = m_spawn->spawns().begin(),
-				end = m_spawn->spawns().end(); it != end; ++it) {
-			const cse_abstract* entity = *it;
-			if (entity->name() == "breakable_object") {
-				xr_ogf_v4* ogf = new xr_ogf_v4;
-				const char* name = entity->name_replace().c_str();
-				msg("loading %s", name);
-				if (!ogf->xr_ogf::load_ogf(level_path, name))
-					xr_not_expected();
-				m_brkbl_meshes.push_back(ogf);
-			}
-		}
+	if (mask & LL_LODS) {
+		m_lods = ::load<xr_image>(level_path, "level_lods.dds");
+		m_lods_nm = ::load<xr_image>(level_path, "level_lods_nm.dds");
 	}
 
-
-	if (m_spawn && xrlc_version >= XRLC_VERSION_13) {
+	if ((mask & LL_BRKBL_MESHES) && m_spawn && xrlc_version >= XRLC_VERSION_12) {
 		for (xr_entity_vec_cit it = m_spawn->spawns().begin(),
 				end = m_spawn->spawns().end(); it != end; ++it) {
 			const cse_abstract* entity = *it;
@@ -280,7 +286,7 @@ void xr_level::load(uint32_t xrlc_version, const char* game_data_path, const cha
 		}
 	}
 
-	if (xrlc_version == XRLC_VERSION_12)
+	if ((mask & LL_GAMEMTLS_LIB) && xrlc_version == XRLC_VERSION_12)
 		m_gamemtls_lib = ::load<xr_gamemtls_lib>(game_data_path, "gamemtl.xr", true);
 
 
@@ -39,12 +39,44 @@ class xr_gamemtls_lib;
 class xr_reader;
 class xr_writer;
 
+// Parts of a level xr_level::load() reads. Files of the parts left out of
+// the mask are never opened and their accessors return 0.
+enum {
+	LL_LTX			= 0x0000001,	// level.ltx
+	LL_GEOM			= 0x0000002,	// level.geom or inside level
+	LL_VISUALS		= 0x0000004,	// implies LL_GEOM
+	LL_SHADERS		= 0x0000008,
+	LL_SECTORS		= 0x0000010,
+	LL_PORTALS		= 0x0000020,
+	LL_LIGHTS		= 0x0000040,
+	LL_GLOWS		= 0x0000080,
+	LL_CFORM		= 0x0000100,
+	LL_HOM			= 0x0000200,
+	LL_DETAILS		= 0x0000400,	// with the texture
+	LL_AI			= 0x0000800,
+	LL_GAME			= 0x0001000,
+	LL_SPAWN		= 0x0002000,
+	LL_WALLMARKS		= 0x0004000,
+	LL_SOM			= 0x0008000,
+	LL_SND_ENV		= 0x0010000,
+	LL_SND_STATIC		= 0x0020000,	// implies LL_LTX before xrLC 13
+	LL_PS_STATIC		= 0x0040000,
+	LL_ENV_MOD		= 0x0080000,
+	LL_FOG_VOL		= 0x0100000,
+	LL_BUILD_LIGHTS		= 0x0200000,
+	LL_LODS			= 0x0400000,	// level_lods.dds and level_lods_nm.dds
+	LL_BRKBL_MESHES		= 0x0800000,	// implies LL_SPAWN
+	LL_GAMEMTLS_LIB		= 0x1000000,
+	LL_ALL			= 0x1ffffff,
+};
+
 class xr_level {
 public:
 			xr_level();
 	virtual		~xr_level();
 
-	bool		load(const char* game_data_path, const char* level_path);
+	bool		load(const char* game_data_path, const char* level_path,
+				uint32_t mask = LL_ALL);
 
 	uint32_t			xrlc_version() const;
 	uint32_t			xrlc_quality() const;
@@ -111,7 +143,7 @@ public:
 
 protected:
 	void	load(uint32_t xrlc_version, const char* game_data_path,
-				const char* level_path, xr_reader& r);
+				const char* level_path, xr_reader& r, uint32_t mask);
 	void	save(xr_writer& w) const;
 
 private:
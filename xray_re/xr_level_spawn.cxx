@@ -13,8 +13,8 @@ xr_level_spawn::~xr_level_spawn()
 
 void xr_level_spawn::load(xr_reader& r)
 {
-	xr_reader* s;
-	for (uint32_t id = 0; (s = r.open_chunk(id)); ++id) {
+	uint32_t id;
+	for (xr_reader* s = 0; (s = r.open_chunk_seq(id, s)) != 0;) {
 		xr_packet packet;
 		s->r_packet(packet, s->size());
 		uint16_t pkt_id;
@@ -31,7 +31,6 @@ void xr_level_spawn::load(xr_reader& r)
 			}
 			m_spawns.push_back(entity);
 		}
-		r.close_chunk(s);
 	}
 }
 
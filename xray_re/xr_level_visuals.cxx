@@ -1,9 +1,11 @@
+#include <memory>
 #include "xr_level_version.h"
 #include "xr_level_visuals.h"
 #include "xr_level_geom.h"
 #include "xr_ogf_v3.h"
 #include "xr_ogf_v4.h"
 #include "xr_reader.h"
+#include "xr_parallel.h"
 
 using namespace xray_re;
 
@@ -11,26 +13,42 @@ xr_level_visuals::~xr_level_visuals() {}
 
 void xr_level_visuals::load_d3d7(xr_reader& r, const xr_level_geom* geom)
 {
-	xr_reader* s;
-	for (uint32_t id = 0; (s = r.open_chunk(id)); ++id) {
+	uint32_t id;
+	for (xr_reader* s = 0; (s = r.open_chunk_seq(id, s)) != 0;) {
 		xr_ogf_v3* ogf = new xr_ogf_v3;
 		ogf->load_ogf(*s);
 		ogf->set_ext_geom(geom->vbufs());
 		m_ogfs.push_back(ogf);
-		r.close_chunk(s);
 	}
 }
 
 void xr_level_visuals::load_d3d9(xr_reader& r, const xr_level_geom* geom)
 {
-	xr_reader* s;
-	for (uint32_t id = 0; (s = r.open_chunk(id)); ++id) {
-		xr_ogf_v4* ogf = new xr_ogf_v4;
+	// visuals do not depend on each other, so locate all the chunks first
+	// and then decode them in parallel, each into its own slot.
+	struct visual_chunk {
+		const uint8_t*	data;
+		size_t		size;
+		bool		compressed;
+	};
+	std::vector<visual_chunk> chunks;
+	visual_chunk chunk;
+	for (uint32_t id = 0; (chunk.size = r.find_chunk(id, &chunk.compressed)) != 0; ++id) {
+		chunk.data = r.pointer<uint8_t>();
+		chunks.push_back(chunk);
+	}
+
+	size_t base = m_ogfs.size();
+	m_ogfs.resize(base + chunks.size(), 0);
+	xr_parallel_for(chunks.size(), [&](size_t i) {
+		const visual_chunk& c = chunks[i];
+		// a throwing load_ogf() must not leak the reader or the visual.
+		std::unique_ptr<xr_reader> s(xr_reader::open_chunk_data(c.data, c.size, c.compressed));
+		std::unique_ptr<xr_ogf_v4> ogf(new xr_ogf_v4);
 		ogf->load_ogf(*s);
 		ogf->set_ext_geom(geom->vbufs(), geom->ibufs(), geom->swibufs());
-		m_ogfs.push_back(ogf);
-		r.close_chunk(s);
-	}
+		m_ogfs[base + i] = ogf.release();
+	});
 }
 
 void xr_level_visuals::load(uint32_t xrlc_version, xr_reader& r, const xr_level_geom* geom)
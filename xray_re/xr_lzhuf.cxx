@@ -12,6 +12,7 @@ All rights reserved. Permission granted for non-commercial use.
 
 #include <cstring>
 #include <cstdlib>
+#include <memory>
 #include "xr_lzhuf.h"
 
 using namespace xray_re;
@@ -219,35 +220,24 @@ const uint8_t _lzhuf::d_len[256] = {
 	0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
 };
 
-int _lzhuf::GetBit(void)	/* get one bit */
+void _lzhuf::FillBuf(void)	/* top up the bit buffer to at least 57 bits */
 {
-	int i;
-
-	while (getlen <= 8) {
-		if ((i = getc()) < 0) i = 0;
-		getbuf |= i << (8 - getlen);
-		getlen += 8;
-	}
-	i = getbuf;
-	getbuf <<= 1;
-	getlen--;
-	return (i >> 15) & 1;
-}
-
-int _lzhuf::GetByte(void)	/* get one byte */
-{
-	unsigned i;
-
-	while (getlen <= 8) {
-		int c = getc();
-		i = (c < 0) ? 0 : c;
-		getbuf |= i << (8 - getlen);
-		getlen += 8;
+	if (m_src_pos + 8 <= m_src_limit) {
+		/* fast path: take as many whole bytes as fit in one go */
+		const uint8_t* p = m_src + m_src_pos;
+		unsigned n = (64 - getlen) >> 3;
+		for (unsigned k = 0; k < n; k++)
+			getbuf |= uint64_t(p[k]) << (56 - getlen - 8*k);
+		m_src_pos += n;
+		getlen += 8*n;
+	} else {
+		/* past the end of input the stream reads as zeroes */
+		while (getlen <= 56) {
+			int c = getc();
+			getbuf |= uint64_t(c < 0 ? 0 : c) << (56 - getlen);
+			getlen += 8;
+		}
 	}
-	i = getbuf;
-	getbuf <<= 8;
-	getlen -= 8;
-	return (i & 0xff00) >> 8;
 }
 
 void _lzhuf::Putcode(int l, unsigned c)		/* output c bits of code */
@@ -421,8 +411,11 @@ int _lzhuf::DecodeChar(void)
 	/* choosing the smaller child node (son[]) if the read bit is 0, */
 	/* the bigger (son[]+1} if 1 */
 	while (c < T) {
-		c += GetBit();
-		c = son[c];
+		if (getlen == 0)
+			FillBuf();
+		c = son[c + unsigned(getbuf >> 63)];
+		getbuf <<= 1;
+		getlen--;
 	}
 	c -= T;
 	update(c);
@@ -434,15 +427,17 @@ int _lzhuf::DecodePosition(void)
 	unsigned i, j, c;
 
 	/* recover upper 6 bits from table */
-	i = GetByte();
+	if (getlen < 16)
+		FillBuf();
+	i = unsigned(getbuf >> 56);
 	c = (unsigned)d_code[i] << 6;
-	j = d_len[i];
+	j = d_len[i] + 6;
 
-	/* read lower 6 bits verbatim */
-	j -= 2;
-	while (j--) {
-		i = (i << 1) + GetBit();
-	}
+	/* read lower 6 bits verbatim: the code is d_len[] bits long, so */
+	/* take it together with the 6 bits that follow in one go */
+	i = unsigned(getbuf >> (64 - j));
+	getbuf <<= j;
+	getlen -= j;
 	return c | (i & 0x3f);
 }
 
@@ -456,7 +451,7 @@ void _lzhuf::Encode(uint8_t*& _code, size_t& _codesize, const uint8_t* _text, si
 	m_src_pos = 0;
 	m_src = _text;
 
-	m_dest_limit = _textsize/2;
+	m_dest_limit = _textsize/2 + 8;
 	m_dest_pos = 4;
 	m_dest = static_cast<uint8_t*>(malloc(m_dest_limit));
 	*(uint32_t*)m_dest = uint32_t(_textsize);
@@ -466,6 +461,9 @@ void _lzhuf::Encode(uint8_t*& _code, size_t& _codesize, const uint8_t* _text, si
 
 	StartHuff();
 	InitTree();
+	/* the match finder looks past the end of short input, so leave */
+	/* nothing there from an earlier call; the output would vary */
+	std::memset(text_buf, 0, sizeof(text_buf));
 	s = 0;
 	r = N - F;
 	for (i = s; i < r; i++)
@@ -476,7 +474,7 @@ void _lzhuf::Encode(uint8_t*& _code, size_t& _codesize, const uint8_t* _text, si
 	for (i = 1; i <= F; i++)
 		InsertNode(r - i);
 	InsertNode(r);
-	do {
+	while (len > 0) {
 		if (match_length > len)
 			match_length = len;
 		if (match_length <= THRESHOLD) {
@@ -502,7 +500,7 @@ void _lzhuf::Encode(uint8_t*& _code, size_t& _codesize, const uint8_t* _text, si
 			r = (r + 1) & (N - 1);
 			if (--len) InsertNode(r);
 		}
-	} while (len > 0);
+	}
 	EncodeEnd();
 	_code = m_dest;
 	_codesize = m_dest_pos;
@@ -514,7 +512,7 @@ void _lzhuf::Decode(uint8_t*& _text, size_t& _textsize, const uint8_t* _code, si
 	size_t count;
 
 	m_dest_limit = textsize = *(uint32_t*)_code;
-	m_dest = static_cast<uint8_t*>(malloc(m_dest_limit));
+	m_dest = static_cast<uint8_t*>(malloc(m_dest_limit ? m_dest_limit : 1));
 	m_dest_pos = 0;
 
 	m_src_limit = codesize = _codesize;
@@ -528,25 +526,28 @@ void _lzhuf::Decode(uint8_t*& _text, size_t& _textsize, const uint8_t* _code, si
 	for (i = 0; i < N - F; i++)
 		text_buf[i] = ' ';
 	r = N - F;
+	uint8_t* dest = m_dest;
 	for (count = 0; count < textsize; ) {
 		c = DecodeChar();
 		if (c < 256) {
-			putc(c);
+			dest[count++] = uint8_t(c);
 			text_buf[r++] = c;
 			r &= (N - 1);
-			count++;
 		} else {
 			i = (r - DecodePosition() - 1) & (N - 1);
 			j = c - 255 + THRESHOLD;
+			/* a broken stream must not overrun the output */
+			if (size_t(j) > textsize - count)
+				j = int(textsize - count);
 			for (k = 0; k < j; k++) {
 				c = text_buf[(i + k) & (N - 1)];
-				putc(c);
+				dest[count++] = uint8_t(c);
 				text_buf[r++] = c;
 				r &= (N - 1);
-				count++;
 			}
 		}
 	}
+	m_dest_pos = count;
 	xr_assert(m_dest_pos == textsize);
 	_text = m_dest;
 	_textsize = textsize;
@@ -573,6 +574,10 @@ void _lzhuf::putc(int c)
 
 xr_lzhuf* xr_lzhuf::instance()
 {
-	static xr_lzhuf instance;
-	return &instance;
+	// _lzhuf keeps the whole coder state in its members, so every thread
+	// gets its own one to let compressed chunks be opened concurrently.
+	static thread_local std::unique_ptr<xr_lzhuf> instance;
+	if (!instance)
+		instance.reset(new xr_lzhuf);
+	return instance.get();
 }
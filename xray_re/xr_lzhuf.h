@@ -9,6 +9,8 @@
 
 namespace xray_re {
 
+// Coder state is kept in the object, so one instance must not be shared
+// between threads. Use xr_lzhuf for per-thread instances or own one.
 class _lzhuf {
 private:
 	enum basic_params {
@@ -40,8 +42,8 @@ private:
 	size_t		m_src_pos;
 	size_t		m_src_limit;
 
-	unsigned	getbuf;
-	unsigned char	getlen;
+	uint64_t	getbuf;		// MSB first
+	unsigned	getlen;
 
 	unsigned	putbuf;
 	unsigned char	putlen;
@@ -55,8 +57,7 @@ private:
 	void	InsertNode(int r);
 	void	DeleteNode(int p);
 
-	int	GetBit(void);
-	int	GetByte(void);
+	void	FillBuf(void);
 	void	Putcode(int l, unsigned c);
 
 	void	StartHuff(void);
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 #include "xr_math.h"
 #include "xr_ogf.h"
 #include "xr_ogf_v3.h"
@@ -8,6 +9,13 @@
 #include "xr_envelope.h"
 #include "xr_file_system.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define XR_OGF_SSE2 1
+#include <emmintrin.h>
+#else
+#define XR_OGF_SSE2 0
+#endif
+
 using namespace xray_re;
 
 void xr_ogf::bone_motion_io::insert_key(float time, const ogf_key_qr* value)
@@ -30,6 +38,127 @@ void xr_ogf::bone_motion_io::insert_key(float time, const fvector3* value)
 	m_envelopes[2]->insert_key(time, value->z);
 }
 
+// Batched version of the quaternion -> dmatrix -> get_euler_xyz() chain
+// above. The rotation matrix terms are taken straight from the quantized
+// components: scaled by the squared quaternion norm they are integers, so
+// they are computed exactly and atan2() doesn't care about the scale. The
+// gimbal lock test becomes an exact test for zero as well. The angles are
+// then found with a float atan2 approximation, four keys at a time with
+// SSE2. They match the double precision path within 1e-6 rad, except
+// that a +-pi angle may come out with the other sign (same rotation).
+
+static inline float atan2_approx(float y, float x)
+{
+	const float PI_F = 3.14159265f;
+	float ax = std::fabs(x), ay = std::fabs(y);
+	bool swap = ay > ax;
+	float num = swap ? ax : ay, den = swap ? ay : ax;
+	float t = den == 0 ? 0 : num/den;
+	float offset = 0;
+	if (t > 0.41421356f) {		// tan(pi/8)
+		t = (t - 1.f)/(t + 1.f);
+		offset = PI_F/4;
+	}
+	float z = t*t;
+	float r = ((((8.05374449538e-2f*z - 1.38776856032e-1f)*z + 1.99777106478e-1f)*z -
+			3.33329491539e-1f)*z*t + t) + offset;
+	if (swap)
+		r = PI_F/2 - r;
+	if (std::signbit(x))
+		r = PI_F - r;
+	return std::signbit(y) ? -r : r;
+}
+
+#if XR_OGF_SSE2
+static inline __m128 select_ps(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// the same steps as atan2_approx(), four at a time.
+static inline __m128 atan2_approx(__m128 y, __m128 x)
+{
+	const __m128 sign = _mm_set1_ps(-0.f);
+	const __m128 zero = _mm_setzero_ps();
+	__m128 ax = _mm_andnot_ps(sign, x), ay = _mm_andnot_ps(sign, y);
+	__m128 swap = _mm_cmpgt_ps(ay, ax);
+	__m128 num = select_ps(swap, ax, ay), den = select_ps(swap, ay, ax);
+	__m128 t = _mm_andnot_ps(_mm_cmpeq_ps(den, zero), _mm_div_ps(num, den));
+	__m128 big = _mm_cmpgt_ps(t, _mm_set1_ps(0.41421356f));
+	__m128 one = _mm_set1_ps(1.f);
+	t = select_ps(big, _mm_div_ps(_mm_sub_ps(t, one), _mm_add_ps(t, one)), t);
+	__m128 offset = _mm_and_ps(big, _mm_set1_ps(3.14159265f/4));
+	__m128 z = _mm_mul_ps(t, t);
+	__m128 p = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(8.05374449538e-2f), z), _mm_set1_ps(1.38776856032e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.99777106478e-1f));
+	p = _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(3.33329491539e-1f));
+	__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z), t), t), offset);
+	r = select_ps(swap, _mm_sub_ps(_mm_set1_ps(3.14159265f/2), r), r);
+	__m128 x_neg = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(x), 31));
+	r = select_ps(x_neg, _mm_sub_ps(_mm_set1_ps(3.14159265f), r), r);
+	return _mm_xor_ps(r, _mm_and_ps(sign, y));
+}
+#endif
+
+void xr_ogf::bone_motion_io::insert_keys(const ogf_key_qr* values, size_t n, float fps)
+{
+	const size_t BLOCK = 256;
+	float times[BLOCK];
+	float n11[BLOCK], n12[BLOCK], n13[BLOCK], n21[BLOCK], n22[BLOCK], n23[BLOCK], n33[BLOCK];
+	float rx[BLOCK], ry[BLOCK], rz[BLOCK];
+
+	size_t base = m_envelopes[3]->num_keys();
+	for (uint_fast32_t i = 3; i != 6; ++i)
+		m_envelopes[i]->reserve_keys(base + n);
+
+	for (size_t first = 0; first < n; first += BLOCK) {
+		size_t m = std::min(BLOCK, n - first);
+		for (size_t i = 0; i != m; ++i) {
+			const ogf_key_qr& q = values[first + i];
+			int64_t xx = q.x*q.x, yy = q.y*q.y, zz = q.z*q.z, ww = q.w*q.w;
+			int64_t xy = q.x*q.y, xz = q.x*q.z, yz = q.y*q.z;
+			int64_t wx = q.w*q.x, wy = q.w*q.y, wz = q.w*q.z;
+			n11[i] = float(ww + xx - yy - zz);
+			n12[i] = float(2*(xy - wz));
+			n13[i] = float(2*(xz + wy));
+			n21[i] = float(2*(xy + wz));
+			n22[i] = float(ww + yy - xx - zz);
+			n23[i] = float(2*(yz - wx));
+			n33[i] = float(ww + zz - xx - yy);
+			times[i] = float(first + i)/fps;
+		}
+		size_t i = 0;
+#if XR_OGF_SSE2
+		for (; i + 4 <= m; i += 4) {
+			__m128 a23 = _mm_loadu_ps(n23 + i), a33 = _mm_loadu_ps(n33 + i);
+			__m128 cy = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(a23, a23), _mm_mul_ps(a33, a33)));
+			__m128 locked = _mm_cmpeq_ps(cy, _mm_setzero_ps());
+			__m128 minus_13 = _mm_xor_ps(_mm_loadu_ps(n13 + i), _mm_set1_ps(-0.f));
+			__m128 minus_21 = _mm_xor_ps(_mm_loadu_ps(n21 + i), _mm_set1_ps(-0.f));
+			__m128 z_y = select_ps(locked, minus_21, _mm_loadu_ps(n12 + i));
+			__m128 z_x = select_ps(locked, _mm_loadu_ps(n22 + i), _mm_loadu_ps(n11 + i));
+			_mm_storeu_ps(rz + i, atan2_approx(z_y, z_x));
+			_mm_storeu_ps(ry + i, atan2_approx(minus_13, cy));
+			_mm_storeu_ps(rx + i, _mm_andnot_ps(locked, atan2_approx(a23, a33)));
+		}
+#endif
+		for (; i != m; ++i) {
+			float cy = std::sqrt(n23[i]*n23[i] + n33[i]*n33[i]);
+			if (cy != 0) {
+				rz[i] = atan2_approx(n12[i], n11[i]);
+				rx[i] = atan2_approx(n23[i], n33[i]);
+			} else {
+				rz[i] = atan2_approx(-n21[i], n22[i]);
+				rx[i] = 0;
+			}
+			ry[i] = atan2_approx(-n13[i], cy);
+		}
+		m_envelopes[3]->insert_keys(m, times, rx);
+		m_envelopes[4]->insert_keys(m, times, ry);
+		m_envelopes[5]->insert_keys(m, times, rz);
+	}
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 xr_ogf::xr_ogf(ogf_version version): m_loaded(0), m_version(version) {}
@@ -53,6 +53,8 @@ public:
 	struct bone_motion_io: public xr_bone_motion {
 		void	insert_key(float time, const ogf_key_qr* value);
 		void	insert_key(float time, const fvector3* value);
+		// n rotation keys sampled at fps, starting from time 0.
+		void	insert_keys(const ogf_key_qr* values, size_t n, float fps);
 	};
 
 protected:
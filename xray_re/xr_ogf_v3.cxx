@@ -246,6 +246,8 @@ void xr_ogf_v3::load_children(xr_reader& r)
 inline void xr_ogf_v3::bone_motion_io::import(xr_reader& r, uint_fast32_t num_keys)
 {
 	create_envelopes();
+	for (uint_fast32_t i = 0; i != 6; ++i)
+		m_envelopes[i]->reserve_keys(num_keys);
 	for (uint_fast32_t i = 0; i != num_keys; ++i) {
 		float time = float(i)/OGF3_MOTION_FPS;
 		insert_key(time, r.skip<ogf_key_qr>());
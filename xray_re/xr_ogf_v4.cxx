@@ -24,6 +24,8 @@ struct xr_ogf_v4::motion_io: public xr_skl_motion {
 			motion_io();
 	uint16_t	import_params(xr_reader& r, unsigned version);
 	void		import_bone_motions(xr_reader& r, xr_bone_vec& all_bones);
+	void		import_quantized(xr_reader& r, const xr_bone_vec& all_bones);
+	void		release();
 };
 
 inline xr_ogf_v4::motion_io::motion_io() { m_fps = OGF4_MOTION_FPS; }
@@ -33,7 +35,7 @@ inline xr_ogf_v4::motion_io::motion_io() { m_fps = OGF4_MOTION_FPS; }
 xr_ogf_v4::xr_ogf_v4(): xr_ogf(OGF4_VERSION), m_fast(0),
 	m_ext_vb_index(0), m_ext_vb_offset(0), m_ext_vb_size(0),
 	m_ext_ib_index(0), m_ext_ib_offset(0), m_ext_ib_size(0),
-	m_ext_swib_index(0)
+	m_ext_swib_index(0), m_lazy_motions(false), m_quantized_motions(false)
 {
 	m_tree_xform = m_tree_xform.identity();
 }
@@ -49,6 +51,8 @@ void xr_ogf_v4::clear()
 	m_swib.clear();
 	m_source.clear();
 	m_export_tool.clear();
+	m_raw_motions.clear();
+	m_motion_entries.clear();
 	delete m_fast;
 	m_fast = 0;
 }
@@ -101,6 +105,12 @@ void xr_ogf_v4::setup_ib0()
 	m_ib0.proxy(m_ib, m_swib[0].offset, m_swib[0].num_tris*3);
 }
 
+void xr_ogf_v4::swi_ib(size_t lod, xr_ibuf& ib) const
+{
+	const ogf4_slide_window& sw = m_swib[lod];
+	ib.proxy(m_ib, sw.offset, sw.num_tris*3);
+}
+
 void xr_ogf_v4::set_ext_geom(const xr_vbuf_vec& ext_vbufs,
 		const xr_ibuf_vec& ext_ibufs, const xr_swibuf_vec& ext_swibufs)
 {
@@ -186,12 +196,11 @@ inline void xr_ogf_v4::load_icontainer(xr_reader& r)
 void xr_ogf_v4::load_children(xr_reader& r)
 {
 	assert(m_children.empty());
-	xr_reader* s;
-	for (uint32_t id = 0; (s = r.open_chunk(id)); ++id) {
+	uint32_t id;
+	for (xr_reader* s = 0; (s = r.open_chunk_seq(id, s)) != 0;) {
 		xr_ogf_v4* ogf = new xr_ogf_v4;
 		ogf->load_ogf(*s);
 		m_children.push_back(ogf);
-		r.close_chunk(s);
 	}
 	set_chunk_loaded(OGF4_CHILDREN);
 }
@@ -298,12 +307,18 @@ void xr_ogf_v4::bone_motion_io::import(xr_reader& r, uint_fast32_t num_keys)
 
 	unsigned flags = r.r_u8();
 
+	size_t num_r_keys = (flags & KPF_R_ABSENT) ? 1 : num_keys;
+	size_t num_t_keys = (flags & KPF_T_PRESENT) ? num_keys : 1;
+	for (uint_fast32_t i = 0; i != 3; ++i) {
+		m_envelopes[i]->reserve_keys(num_t_keys);
+		m_envelopes[i + 3]->reserve_keys(num_r_keys);
+	}
+
 	if (flags & KPF_R_ABSENT) {
 		insert_key(0, r.skip<ogf_key_qr>());
 	} else {
 		r.r_u32();
-		for (size_t i = 0; i != num_keys; ++i)
-			insert_key(i/OGF4_MOTION_FPS, r.skip<ogf_key_qr>());
+		insert_keys(r.skip<ogf_key_qr>(num_keys), num_keys, OGF4_MOTION_FPS);
 	}
 	if (flags & KPF_T_PRESENT) {
 		r.r_u32();
@@ -351,28 +366,154 @@ inline void xr_ogf_v4::motion_io::import_bone_motions(xr_reader& r, xr_bone_vec&
 	}
 }
 
+inline void xr_ogf_v4::motion_io::import_quantized(xr_reader& r, const xr_bone_vec& all_bones)
+{
+	uint_fast32_t num_keys = r.r_u32();
+	m_frame_start = 0;
+	m_frame_end = int32_t(num_keys & INT32_MAX);
+
+	assert(m_quantized_bone_motions.empty());
+	m_quantized_bone_motions.resize(all_bones.size());
+	for (xr_quantized_bone_motion_vec_it it = m_quantized_bone_motions.begin(),
+			end = m_quantized_bone_motions.end(); it != end; ++it) {
+		unsigned flags = r.r_u8();
+		it->flags = flags;
+		if (flags & KPF_R_ABSENT) {
+			it->r_keys = r.skip<ogf_key_qr>();
+		} else {
+			r.r_u32();
+			it->r_keys = r.skip<ogf_key_qr>(num_keys);
+		}
+		if (flags & KPF_T_PRESENT) {
+			r.r_u32();
+			if (flags & KPF_T_HQ)
+				it->t_keys = r.skip<ogf4_key_qt_hq>(num_keys);
+			else
+				it->t_keys = r.skip<ogf4_key_qt>(num_keys);
+			r.r_fvector3(it->t_size);
+			r.r_fvector3(it->t_init);
+		} else {
+			it->t_keys = 0;
+			it->t_size.set();
+			r.r_fvector3(it->t_init);
+		}
+	}
+}
+
+inline void xr_ogf_v4::motion_io::release()
+{
+	delete_elements(m_bone_motions);
+	xr_bone_motion_vec().swap(m_bone_motions);
+	xr_quantized_bone_motion_vec().swap(m_quantized_bone_motions);
+}
+
 void xr_ogf_v4::load_s_motions(xr_reader& r)
 {
 	if (!r.find_chunk(0))
 		xr_not_expected();
 	size_t num_motions = r.r_u32();
 	xr_assert(m_motions.size() == num_motions);
+
+	m_motion_entries.clear();
+	m_motion_entries.reserve(num_motions);
+	for (xr_skl_motion_vec_it it = m_motions.begin(), end = m_motions.end(); it != end; ++it) {
+		motion_entry entry = { static_cast<motion_io*>(*it), 0, 0, MOTION_RAW };
+		m_motion_entries.push_back(entry);
+	}
+	if (m_lazy_motions || m_quantized_motions) {
+		const uint8_t* data = static_cast<const uint8_t*>(r.data());
+		m_raw_motions.assign(data, data + r.size());
+	}
 	for (uint32_t id = 1; id <= num_motions; ++id) {
-		if (!r.find_chunk(id))
+		size_t size = r.find_chunk(id);
+		if (size == 0)
 			xr_not_expected();
 
+		size_t offset = r.tell();
+		// chunks normally come in the order of the definitions, any
+		// other one is matched by name.
 		const char* name = r.skip_sz();
-		motion_io* smotion = static_cast<motion_io*>(find_motion(name));
-		if (smotion == 0) {
-			msg("unknown motion %s", name);
-			throw xr_error();
+		size_t index = id - 1;
+		if (m_motions[index]->name() != name) {
+			xr_skl_motion_vec_it it = std::find(m_motions.begin(), m_motions.end(), find_motion(name));
+			if (it == m_motions.end()) {
+				msg("unknown motion %s", name);
+				throw xr_error();
+			}
+			index = it - m_motions.begin();
+		}
+		motion_entry& entry = m_motion_entries[index];
+		if (m_lazy_motions || m_quantized_motions) {
+			entry.offset = offset;
+			entry.size = size;
+			r.seek(offset + size);
+			if (!m_lazy_motions) {
+				decode_motion(entry);
+				entry.state = MOTION_DECODED;
+			}
+		} else {
+			entry.motion->import_bone_motions(r, m_bones);
+			entry.state = MOTION_DECODED;
 		}
-		smotion->import_bone_motions(r, m_bones);
 		r.debug_find_chunk();
 	}
 	set_chunk_loaded(OGF4_S_MOTIONS);
 }
 
+// decoded is set if this very call did the decoding. The lock only
+// guards the entry states, so different motions decode in parallel and
+// callers asking for one being decoded wait for it.
+const xr_skl_motion* xr_ogf_v4::decode_motion(size_t id, bool* decoded) const
+{
+	std::unique_lock<std::mutex> lock(m_motion_mutex);
+	if (decoded)
+		*decoded = false;
+	if (id >= m_motion_entries.size())
+		return 0;
+	motion_entry& entry = m_motion_entries[id];
+	while (entry.state == MOTION_DECODING)
+		m_motion_decoded.wait(lock);
+	if (entry.state == MOTION_RAW) {
+		entry.state = MOTION_DECODING;
+		lock.unlock();
+		decode_motion(entry);
+		lock.lock();
+		entry.state = MOTION_DECODED;
+		m_motion_decoded.notify_all();
+		if (decoded)
+			*decoded = true;
+	}
+	return entry.motion;
+}
+
+// touches nothing but the entry's own motion, so needs no lock.
+void xr_ogf_v4::decode_motion(motion_entry& entry) const
+{
+	xr_reader r(&m_raw_motions[entry.offset], entry.size);
+	r.skip_sz();
+	if (m_quantized_motions) {
+		entry.motion->import_quantized(r, m_bones);
+	} else {
+		// bones are created by OGF4_S_SMPARAMS and never change afterwards.
+		entry.motion->import_bone_motions(r, const_cast<xr_bone_vec&>(m_bones));
+	}
+}
+
+bool xr_ogf_v4::motion_decoded(size_t id) const
+{
+	std::lock_guard<std::mutex> lock(m_motion_mutex);
+	return id < m_motion_entries.size() && m_motion_entries[id].state == MOTION_DECODED;
+}
+
+void xr_ogf_v4::release_motion(size_t id) const
+{
+	std::lock_guard<std::mutex> lock(m_motion_mutex);
+	if (id >= m_motion_entries.size() || m_motion_entries[id].state != MOTION_DECODED || !m_lazy_motions)
+		return;
+	m_motion_entries[id].motion->release();
+	m_motion_entries[id].state = MOTION_RAW;
+}
+
 inline void xr_ogf_v4::partition_io::import(xr_reader& r, xr_bone_vec& all_bones)
 {
 	r.r_sz(m_name);
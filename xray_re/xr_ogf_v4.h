@@ -4,6 +4,9 @@
 #ifndef __XR_OGF_V4_H__
 #define __XR_OGF_V4_H__
 
+#include <condition_variable>
+#include <mutex>
+#include <string>
 #include <vector>
 #include "xr_ogf.h"
 
@@ -44,6 +47,28 @@ public:
 
 	uint32_t		ext_swib_index() const;
 
+	// Slide windows (SWI levels of detail) of a progressive visual, the
+	// finest first; ib() is window 0. swi_ib() proxies the indices of one.
+	const xr_swibuf&	swib() const;
+	void			swi_ib(size_t lod, xr_ibuf& ib) const;
+
+	// With lazy motions set before loading, OGF4_S_MOTIONS is only indexed
+	// and every motion is decoded on the first decode_motion() call; until
+	// then its bone motions are empty. Safe to call from several threads.
+	// Motions are addressed by their index in motions(), as names need
+	// not be unique.
+	void			set_lazy_motions(bool lazy);
+	// Keep the motions quantized (see xr_skl_motion::quantized()), they
+	// point into the retained OGF4_S_MOTIONS copy.
+	void			set_quantized_motions(bool quantized);
+	const xr_skl_motion*	decode_motion(size_t id, bool* decoded = 0) const;
+	bool			motion_decoded(size_t id) const;
+	// Drops the decoded bone motions again; the next decode_motion()
+	// decodes them anew. Only for lazily loaded sets, and only once no
+	// one uses the motion any more.
+	void			release_motion(size_t id) const;
+	size_t			raw_motions_size() const;
+
 public:
 	struct bone_io;
 	struct partition_io;
@@ -96,6 +121,21 @@ private:
 
 	void	setup_ib0();
 
+	enum motion_state {
+		MOTION_RAW,
+		MOTION_DECODING,	// by some thread, without m_motion_mutex held
+		MOTION_DECODED,
+	};
+
+	struct motion_entry {
+		motion_io*	motion;
+		size_t		offset;		// into m_raw_motions, if not decoded
+		size_t		size;
+		motion_state	state;
+	};
+
+	void	decode_motion(motion_entry& entry) const;
+
 private:
 	uint32_t	m_shader_id;	// OGF_HEADER
 
@@ -127,6 +167,13 @@ private:
 	uint32_t	m_ext_ib_size;
 
 	uint32_t	m_ext_swib_index;	// OGF_SWICONTAINER
+
+	bool		m_lazy_motions;
+	bool		m_quantized_motions;
+	std::vector<uint8_t>	m_raw_motions;	// OGF4_S_MOTIONS copy for lazy/quantized motions
+	mutable std::vector<motion_entry>	m_motion_entries;	// parallel to m_motions
+	mutable std::mutex	m_motion_mutex;
+	mutable std::condition_variable	m_motion_decoded;
 };
 
 TYPEDEF_STD_VECTOR_PTR(xr_ogf_v4)
@@ -144,6 +191,10 @@ inline uint32_t xr_ogf_v4::ext_ib_index() const { return m_ext_ib_index; }
 inline uint32_t xr_ogf_v4::ext_ib_offset() const { return m_ext_ib_offset; }
 inline uint32_t xr_ogf_v4::ext_ib_size() const { return m_ext_ib_size; }
 inline uint32_t xr_ogf_v4::ext_swib_index() const { return m_ext_swib_index; }
+inline const xr_swibuf& xr_ogf_v4::swib() const { return m_swib; }
+inline void xr_ogf_v4::set_lazy_motions(bool lazy) { m_lazy_motions = lazy; }
+inline void xr_ogf_v4::set_quantized_motions(bool quantized) { m_quantized_motions = quantized; }
+inline size_t xr_ogf_v4::raw_motions_size() const { return m_raw_motions.size(); }
 
 } // end of namespace xray_re
 
@@ -0,0 +1,154 @@
+#include "xr_omf_cache.h"
+#include "xr_ogf_v4.h"
+#include "xr_skl_motion.h"
+#include "xr_envelope.h"
+#include "xr_file_system.h"
+
+using namespace xray_re;
+
+xr_omf_cache::xr_omf_cache(): m_budget(size_t(512) << 20), m_bytes(0),
+	m_hits(0), m_misses(0), m_evictions(0) {}
+
+std::shared_ptr<const xr_ogf_v4> xr_omf_cache::load(const std::string& path,
+		const xr_motion_filter& filter)
+{
+	std::shared_ptr<const xr_ogf_v4> omf = open(path);
+	if (!omf)
+		return omf;
+	for (size_t id = 0, n = omf->motions().size(); id != n; ++id) {
+		if (filter.match(omf->motions()[id]->name()))
+			decode(path, omf, id);
+	}
+	return omf;
+}
+
+const xr_skl_motion* xr_omf_cache::decode(const std::string& path,
+		const std::shared_ptr<const xr_ogf_v4>& omf, size_t id)
+{
+	bool decoded;
+	const xr_skl_motion* motion = omf->decode_motion(id, &decoded);
+	if (decoded) {
+		// charge the newly decoded motion, unless the set is gone already.
+		size_t size = estimate_size(motion);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::map<std::string, entry_list::iterator>::iterator it = m_index.find(path);
+		if (it != m_index.end() && it->second->omf == omf) {
+			it->second->size += size;
+			m_bytes += size;
+			evict();
+		}
+	}
+	return motion;
+}
+
+std::shared_ptr<const xr_ogf_v4> xr_omf_cache::open(const std::string& path)
+{
+	uint32_t age = xr_file_system::file_age(path);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::map<std::string, entry_list::iterator>::iterator it = m_index.find(path);
+		if (it != m_index.end()) {
+			if (it->second->age == age) {
+				m_entries.splice(m_entries.begin(), m_entries, it->second);
+				++m_hits;
+				return it->second->omf;
+			}
+			// the file was rewritten, forget the stale copy.
+			m_bytes -= it->second->size;
+			m_entries.erase(it->second);
+			m_index.erase(it);
+		}
+		++m_misses;
+	}
+
+	// index without holding the lock, so other paths can be served.
+	std::shared_ptr<xr_ogf_v4> omf(new xr_ogf_v4);
+	omf->set_lazy_motions(true);
+	if (!omf->load_omf(path.c_str()))
+		return std::shared_ptr<const xr_ogf_v4>();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::map<std::string, entry_list::iterator>::iterator it = m_index.find(path);
+	if (it != m_index.end() && it->second->age == age) {
+		// somebody else decoded it meanwhile; share theirs.
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		return it->second->omf;
+	}
+	if (it != m_index.end()) {
+		m_bytes -= it->second->size;
+		m_entries.erase(it->second);
+		m_index.erase(it);
+	}
+	entry e = { path, age, estimate_size(omf.get()), omf };
+	m_entries.push_front(e);
+	m_index[path] = m_entries.begin();
+	m_bytes += e.size;
+	evict();
+	return e.omf;
+}
+
+size_t xr_omf_cache::estimate_size(const xr_skl_motion* motion)
+{
+	const xr_bone_motion_vec& bone_motions = motion->bone_motions();
+	size_t size = sizeof(xr_skl_motion) + bone_motions.size()*sizeof(xr_bone_motion) +
+			motion->quantized_bone_motions().size()*sizeof(xr_quantized_bone_motion);
+	for (xr_bone_motion_vec_cit it = bone_motions.begin(), end = bone_motions.end(); it != end; ++it) {
+		for (uint_fast32_t i = 0; i != 6; ++i) {
+			if (const xr_envelope* env = (*it)->envelopes()[i])
+				size += sizeof(xr_envelope) + env->num_keys()*2*sizeof(float) +
+						env->params().size()*sizeof(xr_key_params);
+		}
+	}
+	return size;
+}
+
+size_t xr_omf_cache::estimate_size(const xr_ogf_v4* omf)
+{
+	size_t size = sizeof(xr_ogf_v4) + omf->raw_motions_size();
+	for (size_t id = 0, n = omf->motions().size(); id != n; ++id) {
+		// another thread may be decoding it right now.
+		if (omf->motion_decoded(id))
+			size += estimate_size(omf->motions()[id]);
+	}
+	return size;
+}
+
+void xr_omf_cache::evict()
+{
+	// never drop the set that has just been added.
+	while (m_bytes > m_budget && m_entries.size() > 1) {
+		entry& e = m_entries.back();
+		m_bytes -= e.size;
+		m_index.erase(e.path);
+		m_entries.pop_back();
+		++m_evictions;
+	}
+}
+
+void xr_omf_cache::set_budget(size_t bytes)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_budget = bytes;
+	evict();
+}
+
+size_t xr_omf_cache::budget() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_budget;
+}
+
+xr_omf_cache::statistics xr_omf_cache::stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	statistics s = { m_hits, m_misses, m_evictions, m_entries.size(), m_bytes };
+	return s;
+}
+
+void xr_omf_cache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.clear();
+	m_index.clear();
+	m_bytes = 0;
+}
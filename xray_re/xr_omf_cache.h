@@ -0,0 +1,86 @@
+#ifndef __GNUC__
+#pragma once
+#endif
+#ifndef __XR_OMF_CACHE_H__
+#define __XR_OMF_CACHE_H__
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "xr_types.h"
+#include "xr_skl_motion.h"
+
+namespace xray_re {
+
+class xr_ogf_v4;
+
+// Process-wide cache of decoded OMF motion sets keyed by the resolved
+// path and modification time. Motion sets are handed out as shared
+// read-only objects, so any number of actors (and threads) may use the
+// same one. Sets are indexed lazily and only the motions accepted by the
+// caller's filter get decoded, so a set grows as more of it is asked for.
+// Least recently used sets are dropped once the estimated size exceeds
+// the budget; callers keep theirs alive.
+class xr_omf_cache {
+public:
+	struct statistics {
+		size_t		hits;
+		size_t		misses;
+		size_t		evictions;
+		size_t		entries;
+		size_t		bytes;
+	};
+
+				xr_omf_cache();
+
+	static xr_omf_cache&	instance();
+
+	std::shared_ptr<const xr_ogf_v4>	load(const std::string& path,
+							const xr_motion_filter& filter = xr_motion_filter());
+	// Indexes the set without decoding anything; decode() then decodes
+	// single motions of it, e.g. from worker threads.
+	std::shared_ptr<const xr_ogf_v4>	open(const std::string& path);
+	const xr_skl_motion*	decode(const std::string& path,
+						const std::shared_ptr<const xr_ogf_v4>& omf,
+						size_t id);
+
+	void			set_budget(size_t bytes);
+	size_t			budget() const;
+	statistics		stats() const;
+	void			clear();
+
+private:
+	struct entry {
+		std::string				path;
+		uint32_t				age;
+		size_t					size;
+		std::shared_ptr<const xr_ogf_v4>	omf;
+	};
+	typedef std::list<entry> entry_list;
+
+	static size_t		estimate_size(const xr_skl_motion* motion);
+	static size_t		estimate_size(const xr_ogf_v4* omf);
+	void			evict();
+
+private:
+	mutable std::mutex	m_mutex;
+	entry_list		m_entries;	// most recently used first
+	std::map<std::string, entry_list::iterator>	m_index;
+	size_t			m_budget;
+	size_t			m_bytes;
+	size_t			m_hits;
+	size_t			m_misses;
+	size_t			m_evictions;
+};
+
+inline xr_omf_cache& xr_omf_cache::instance()
+{
+	static xr_omf_cache instance0;
+	return instance0;
+}
+
+} // end of namespace xray_re
+
+#endif
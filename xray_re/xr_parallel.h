@@ -0,0 +1,65 @@
+#ifndef __GNUC__
+#pragma once
+#endif
+#ifndef __XR_PARALLEL_H__
+#define __XR_PARALLEL_H__
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+
+namespace xray_re {
+
+inline unsigned xr_num_threads()
+{
+	unsigned n = std::thread::hardware_concurrency();
+	return n ? n : 1;
+}
+
+// Calls func(i) for every i in [0, n) from up to num_threads threads (one
+// per hardware thread by default) and returns when all calls are done.
+// Indices are handed out one at a time, so uneven items balance out.
+// If a call throws, the remaining indices are skipped and the first
+// exception is rethrown in the calling thread.
+template<typename F> void xr_parallel_for(size_t n, F func, unsigned num_threads = 0)
+{
+	if (num_threads == 0)
+		num_threads = xr_num_threads();
+	if (num_threads > n)
+		num_threads = unsigned(n);
+	if (num_threads <= 1) {
+		for (size_t i = 0; i != n; ++i)
+			std::invoke(func, i);
+		return;
+	}
+	std::atomic<size_t> next(0);
+	std::exception_ptr error;
+	std::mutex error_mutex;
+	auto worker = [&]() {
+		try {
+			for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n;)
+				std::invoke(func, i);
+		} catch (...) {
+			next.store(n, std::memory_order_relaxed);
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (!error)
+				error = std::current_exception();
+		}
+	};
+	std::vector<std::thread> threads;
+	threads.reserve(num_threads - 1);
+	for (unsigned k = 1; k != num_threads; ++k)
+		threads.emplace_back(worker);
+	worker();
+	for (std::vector<std::thread>::iterator it = threads.begin(), end = threads.end(); it != end; ++it)
+		it->join();
+	if (error)
+		std::rethrow_exception(error);
+}
+
+} // end of namespace xray_re
+
+#endif
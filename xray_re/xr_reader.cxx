@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include "xr_reader.h"
@@ -8,9 +9,11 @@ using namespace xray_re;
 
 const uint32_t CHUNK_ID_MASK = ~xr_reader::CHUNK_COMPRESSED;
 
-xr_reader::xr_reader(): m_data(0), m_p(0), m_end(0), m_next(0) {}
+xr_reader::xr_reader(): m_data(0), m_p(0), m_end(0), m_next(0),
+	m_chunk_dir_built(false), m_chunk_dir_dense(false) {}
 
-xr_reader::xr_reader(const void* data, size_t size)
+xr_reader::xr_reader(const void* data, size_t size):
+	m_chunk_dir_built(false), m_chunk_dir_dense(false)
 {
 	m_next = m_p = m_data = static_cast<const uint8_t*>(data);
 	m_end = m_data + size;
@@ -18,10 +21,80 @@ xr_reader::xr_reader(const void* data, size_t size)
 
 xr_reader::~xr_reader() {}
 
+void xr_reader::build_chunk_dir()
+{
+	m_chunk_dir_built = true;
+	m_chunk_dir.clear();
+
+	std::vector<chunk_entry> chunks;
+	uint32_t max_id = 0;
+	for (const uint8_t* p = m_data; p + 8 <= m_end;) {
+		chunk_entry chunk;
+		chunk.id = reinterpret_cast<const uint32_t*>(p)[0];
+		chunk.size = reinterpret_cast<const uint32_t*>(p)[1];
+		p += 8;
+		// stop on trailing garbage, just like the sequential scan would.
+		if (chunk.size > size_t(m_end - p))
+			break;
+		chunk.offset = p - m_data;
+		chunks.push_back(chunk);
+		max_id = std::max(max_id, chunk.id & CHUNK_ID_MASK);
+		p += chunk.size;
+	}
+	if (chunks.empty())
+		return;
+
+	m_chunk_dir_dense = max_id < 2*chunks.size() + 16;
+	if (m_chunk_dir_dense) {
+		chunk_entry hole = { 0, 0, 0 };
+		m_chunk_dir.assign(max_id + 1, hole);
+		// the first chunk with the given id wins, as in the sequential scan.
+		for (std::vector<chunk_entry>::reverse_iterator it = chunks.rbegin(),
+				end = chunks.rend(); it != end; ++it) {
+			m_chunk_dir[it->id & CHUNK_ID_MASK] = *it;
+		}
+	} else {
+		m_chunk_dir.swap(chunks);
+		std::stable_sort(m_chunk_dir.begin(), m_chunk_dir.end(),
+				[](const chunk_entry& a, const chunk_entry& b) {
+			return (a.id & CHUNK_ID_MASK) < (b.id & CHUNK_ID_MASK);
+		});
+	}
+}
+
+const xr_reader::chunk_entry* xr_reader::lookup_chunk(uint32_t find_id)
+{
+	if (!m_chunk_dir_built)
+		build_chunk_dir();
+	if (m_chunk_dir_dense) {
+		if (find_id >= m_chunk_dir.size() || m_chunk_dir[find_id].size == 0)
+			return 0;
+		return &m_chunk_dir[find_id];
+	}
+	std::vector<chunk_entry>::const_iterator it = std::lower_bound(
+			m_chunk_dir.begin(), m_chunk_dir.end(), find_id,
+			[](const chunk_entry& a, uint32_t id) {
+		return (a.id & CHUNK_ID_MASK) < id;
+	});
+	if (it == m_chunk_dir.end() || (it->id & CHUNK_ID_MASK) != find_id)
+		return 0;
+	return &*it;
+}
+
 size_t xr_reader::find_chunk(uint32_t find_id, bool* compressed, bool reset)
 {
-	if (reset)
-		m_p = m_data;
+	if (reset) {
+		const chunk_entry* chunk = lookup_chunk(find_id);
+		if (chunk == 0) {
+			m_p = m_end;
+			return 0;
+		}
+		xr_assert(compressed || (chunk->id & CHUNK_COMPRESSED) == 0);
+		if (compressed != 0)
+			*compressed = (chunk->id & CHUNK_COMPRESSED) != 0;
+		m_p = m_data + chunk->offset;
+		return chunk->size;
+	}
 	while (m_p < m_end) {
 		assert(m_p + 8 <= m_end);
 		uint32_t id = r_u32();
@@ -47,13 +120,18 @@ xr_reader* xr_reader::open_chunk(uint32_t id)
 	size_t size = find_chunk(id, &compressed);
 	if (size == 0)
 		return 0;
+	return open_chunk_data(m_p, size, compressed);
+}
+
+xr_reader* xr_reader::open_chunk_data(const void* data, size_t size, bool compressed)
+{
 	if (compressed) {
 		size_t real_size;
-		uint8_t* data;
-		xr_lzhuf::decompress(data, real_size, m_p, size);
-		return new xr_temp_reader(data, real_size);
+		uint8_t* real_data;
+		xr_lzhuf::decompress(real_data, real_size, static_cast<const uint8_t*>(data), size);
+		return new xr_temp_reader(real_data, real_size);
 	} else {
-		return new xr_reader(m_p, size);
+		return new xr_reader(data, size);
 	}
 }
 
@@ -90,6 +168,17 @@ xr_reader* xr_reader::open_chunk_next(uint32_t& _id, xr_reader* prev)
 	return 0;
 }
 
+xr_reader* xr_reader::open_chunk_seq(uint32_t& id, xr_reader* prev)
+{
+	if (prev) {
+		delete prev;
+		++id;
+	} else {
+		id = 0;
+	}
+	return open_chunk(id);
+}
+
 size_t xr_reader::r_raw_chunk(uint32_t id, void *dest, size_t dest_size)
 {
 	bool compressed;
@@ -32,6 +32,11 @@ public:
 	xr_reader*	open_chunk(uint32_t id);
 	xr_reader*	open_chunk(uint32_t id, const xr_scrambler& scrambler);
 	xr_reader*	open_chunk_next(uint32_t& id, xr_reader* iter);
+	xr_reader*	open_chunk_seq(uint32_t& id, xr_reader* iter);
+	// opens the chunk data located by find_chunk(). Unlike open_chunk()
+	// it does not touch any reader state, so it is safe to call from
+	// several threads on chunks collected up front.
+	static xr_reader*	open_chunk_data(const void* data, size_t size, bool compressed);
 	void		close_chunk(xr_reader*& r) const;
 
 	size_t		size() const;
@@ -99,6 +104,21 @@ protected:
 	const uint8_t*	m_next;
 
 private:
+	struct chunk_entry {
+		uint32_t	id;		// with CHUNK_COMPRESSED bit
+		uint32_t	size;
+		size_t		offset;		// chunk data offset
+	};
+
+	void			build_chunk_dir();
+	const chunk_entry*	lookup_chunk(uint32_t id);
+
+	// lazily built on the first lookup, indexed by id if ids are dense
+	// enough, otherwise sorted by id.
+	std::vector<chunk_entry>	m_chunk_dir;
+	bool		m_chunk_dir_built;
+	bool		m_chunk_dir_dense;
+
 //	const uint8_t*	m_debug_find_chunk;
 };
 
@@ -206,11 +226,10 @@ template<> inline size_t xr_reader::r_chunk(uint32_t id, std::string& value)
 
 template<typename T, typename F> inline void xr_reader::r_chunks(T& container, F read)
 {
-	xr_reader* s;
-	for (uint32_t id = 0; (s = open_chunk(id)); ++id) {
+	uint32_t id;
+	for (xr_reader* s = 0; (s = open_chunk_seq(id, s)) != 0;) {
 		container.push_back(typename T::value_type());
 		std::invoke(read, container.back(), *s);
-		close_chunk(s);
 	}
 }
 
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include "xr_skl_motion.h"
 #include "xr_envelope.h"
+#include "xr_ogf_format.h"
+#include "xr_matrix.h"
 #include "xr_utils.h"
 #include "xr_string_utils.h"
 #include "xr_file_system.h"
@@ -199,7 +202,98 @@ bool xr_skl_motion::save_skl(const char* path) const
 	return status;
 }
 
+// Key i of a quantized bone, dequantized the same way the OGF v4 loader
+// does it when building envelopes.
+static void quantized_key(const xr_quantized_bone_motion& bm, size_t i, fvector3& t, dquaternion& q)
+{
+	bm.r_keys[(bm.flags & KPF_R_ABSENT) ? 0 : i].dequantize(q);
+	if (bm.t_keys == 0) {
+		t = bm.t_init;
+		return;
+	}
+	if (bm.flags & KPF_T_HQ)
+		static_cast<const ogf4_key_qt_hq*>(bm.t_keys)[i].dequantize(t, bm.t_size);
+	else
+		static_cast<const ogf4_key_qt*>(bm.t_keys)[i].dequantize(t, bm.t_size);
+	t.add(bm.t_init);
+}
+
+static void quantized_rotation(const dquaternion& q, fvector3& r)
+{
+	dmatrix xform;
+	xform.rotation(q);
+	dvector3 euler;
+	xform.get_euler_xyz(euler);
+	// same component order as xr_bone_motion::evaluate().
+	r.set(float(euler.y), float(euler.x), float(euler.z));
+}
+
 void xr_skl_motion::evaluate(uint16_t bone_id, float time, fvector3& t, fvector3& r) const
 {
-	m_bone_motions.at(bone_id)->evaluate(time, t, r);
+	if (!quantized()) {
+		m_bone_motions.at(bone_id)->evaluate(time, t, r);
+		return;
+	}
+	const xr_quantized_bone_motion& bm = m_quantized_bone_motions.at(bone_id);
+
+	// keys are evenly spaced from frame 0, hold the ends outside of the motion.
+	int32_t last = std::max<int32_t>(m_frame_end - 1, 0);
+	float frame = std::min(std::max(time*m_fps, 0.f), float(last));
+	int32_t i0 = int32_t(frame);
+	double k = frame - float(i0);
+
+	dquaternion q0;
+	quantized_key(bm, size_t(i0), t, q0);
+	if (k != 0) {
+		fvector3 t1;
+		dquaternion q1;
+		quantized_key(bm, size_t(std::min(i0 + 1, last)), t1, q1);
+		t.lerp(t, t1, float(k));
+		// nlerp along the shorter arc, indistinguishable from slerp
+		// between neighbouring keys.
+		double k1 = q0.dot_product(q1) < 0 ? -k : k;
+		q0.x = q0.x*(1 - k) + q1.x*k1;
+		q0.y = q0.y*(1 - k) + q1.y*k1;
+		q0.z = q0.z*(1 - k) + q1.z*k1;
+		q0.w = q0.w*(1 - k) + q1.w*k1;
+		q0.normalize();
+	}
+	quantized_rotation(q0, r);
+}
+
+void xr_skl_motion::sample(int32_t frame, fvector3* t, fvector3* r) const
+{
+	if (!quantized()) {
+		float time = float(frame)/m_fps;
+		for (size_t i = 0, n = m_bone_motions.size(); i != n; ++i)
+			m_bone_motions[i]->evaluate(time, t[i], r[i]);
+		return;
+	}
+	size_t key = size_t(std::min(std::max<int32_t>(frame, 0), std::max<int32_t>(m_frame_end - 1, 0)));
+	dquaternion q;
+	for (size_t i = 0, n = m_quantized_bone_motions.size(); i != n; ++i) {
+		quantized_key(m_quantized_bone_motions[i], key, t[i], q);
+		quantized_rotation(q, r[i]);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool xr_motion_filter::set_pattern(const std::string& pattern)
+{
+	try {
+		m_pattern.assign(pattern, std::regex::ECMAScript|std::regex::optimize);
+	} catch (const std::regex_error&) {
+		msg("bad motion pattern %s", pattern.c_str());
+		return false;
+	}
+	m_has_pattern = true;
+	return true;
+}
+
+bool xr_motion_filter::match(const std::string& name) const
+{
+	if (empty() || m_names.find(name) != m_names.end())
+		return true;
+	return m_has_pattern && std::regex_match(name, m_pattern);
 }
@@ -4,12 +4,15 @@
 #ifndef __XR_SKL_MOTION_H__
 #define __XR_SKL_MOTION_H__
 
+#include <regex>
+#include <set>
 #include "xr_motion.h"
 #include "xr_vector3.h"
 
 namespace xray_re {
 
 class xr_envelope;
+struct ogf_key_qr;
 
 class xr_bone_motion {
 public:
@@ -61,6 +64,19 @@ protected:
 
 TYPEDEF_STD_VECTOR_PTR(xr_motion_marks)
 
+// OGF v4 key streams of one bone as stored in OGF4_S_MOTIONS (see
+// ogf4_key_presence_flag). The keys are not owned, they point into the
+// motion data kept by whoever loaded the motion.
+struct xr_quantized_bone_motion {
+	const ogf_key_qr*	r_keys;		// one key if KPF_R_ABSENT
+	const void*		t_keys;		// ogf4_key_qt(_hq), 0 if constant
+	fvector3		t_init;		// the constant translation if !t_keys
+	fvector3		t_size;
+	unsigned		flags;
+};
+
+TYPEDEF_STD_VECTOR(xr_quantized_bone_motion)
+
 const uint16_t ALL_PARTITIONS = UINT16_MAX;
 
 class xr_skl_motion: public xr_motion {
@@ -74,9 +90,18 @@ public:
 	bool		save_skl(const char* path) const;
 
 	void		evaluate(uint16_t bone_id, float time, fvector3& t, fvector3& r) const;
+	// all bones at once, t and r hold one entry per bone.
+	void		sample(int32_t frame, fvector3* t, fvector3* r) const;
+
+	// Quantized motions keep the original OGF v4 key streams instead of
+	// envelopes (bone_motions() is empty); evaluate() and sample()
+	// dequantize them on demand.
+	bool		quantized() const;
+	size_t		num_bones() const;
 
 	const xr_bone_motion_vec&	bone_motions() const;
 	xr_bone_motion_vec&		bone_motions();
+	const xr_quantized_bone_motion_vec&	quantized_bone_motions() const;
 
 	uint8_t		bone_motion_flags(uint16_t bone_id) const;
 
@@ -96,6 +121,7 @@ protected:
 	};
 
 	xr_bone_motion_vec		m_bone_motions;
+	xr_quantized_bone_motion_vec	m_quantized_bone_motions;
 	uint16_t			m_bone_or_part;
 	float				m_speed;
 	float				m_accrue;
@@ -108,6 +134,25 @@ protected:
 
 TYPEDEF_STD_VECTOR_PTR(xr_skl_motion)
 
+// Selects motions by name: an explicit allow-list and/or a regular
+// expression that must match the whole name. An empty filter accepts
+// everything.
+class xr_motion_filter {
+public:
+			xr_motion_filter();
+
+	void		allow(const std::string& name);
+	bool		set_pattern(const std::string& pattern);
+
+	bool		empty() const;
+	bool		match(const std::string& name) const;
+
+protected:
+	std::set<std::string>	m_names;
+	std::regex		m_pattern;
+	bool			m_has_pattern;
+};
+
 inline std::string& xr_bone_motion::name() { return m_name; }
 inline const std::string& xr_bone_motion::name() const { return m_name; }
 inline xr_envelope* const* xr_bone_motion::envelopes() { return m_envelopes; }
@@ -119,6 +164,15 @@ inline uint8_t xr_skl_motion::bone_motion_flags(uint16_t bone_id) const
 {
 	return m_bone_motions.at(bone_id)->flags();
 }
+inline bool xr_skl_motion::quantized() const { return !m_quantized_bone_motions.empty(); }
+inline size_t xr_skl_motion::num_bones() const
+{
+	return quantized() ? m_quantized_bone_motions.size() : m_bone_motions.size();
+}
+inline const xr_quantized_bone_motion_vec& xr_skl_motion::quantized_bone_motions() const
+{
+	return m_quantized_bone_motions;
+}
 inline const xr_bone_motion_vec& xr_skl_motion::bone_motions() const
 {
 	return m_bone_motions;
@@ -128,6 +182,10 @@ inline xr_bone_motion_vec& xr_skl_motion::bone_motions()
 	return m_bone_motions;
 }
 
+inline xr_motion_filter::xr_motion_filter(): m_has_pattern(false) {}
+inline void xr_motion_filter::allow(const std::string& name) { m_names.insert(name); }
+inline bool xr_motion_filter::empty() const { return m_names.empty() && !m_has_pattern; }
+
 } // end of namespace xray_re
 
 #endif
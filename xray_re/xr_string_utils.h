@@ -7,6 +7,9 @@
 #include <string>
 #include <cstring>
 #include <cctype>
+#if !defined(_MSC_VER)
+#include <strings.h>
+#endif
 
 namespace xray_re {
 
@@ -21,14 +24,18 @@ static inline void xr_strlwr(char* s, size_t n)
 #if defined(_MSC_VER) && _MSC_VER >= 1400
 	_strlwr_s(s, n);
 #else
-	for (int c; (c = *s) != 0;)
+	for (int c; n != 0 && (c = *s) != 0; --n)
 		*s++ = std::tolower(c);
 #endif
 }
 
 static inline int xr_stricmp(const char* s1, const char* s2)
 {
+#if defined(_MSC_VER)
 	return _stricmp(s1, s2);
+#else
+	return strcasecmp(s1, s2);
+#endif
 }
 
 #if defined(_MSC_VER) && _MSC_VER >= 1400
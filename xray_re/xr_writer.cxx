@@ -1,9 +1,13 @@
 #include <string>
+#include <cstdlib>
 #include <cstring>
 #include <cstdarg>
 #include "xr_writer.h"
+#include "xr_reader.h"
 #include "xr_file_system.h"
 #include "xr_packet.h"
+#include "xr_lzhuf.h"
+#include "xr_parallel.h"
 
 using namespace xray_re;
 
@@ -33,6 +37,38 @@ void xr_writer::w_raw_chunk(uint32_t id, const void* data, size_t size)
 	w_raw(data, size);
 }
 
+void xr_writer::w_compressed_chunk(uint32_t id, const void* data, size_t size)
+{
+	uint8_t* code;
+	size_t code_size;
+	xr_lzhuf::compress(code, code_size, static_cast<const uint8_t*>(data), size);
+	w_u32(id | xr_reader::CHUNK_COMPRESSED);
+	w_size_u32(code_size);
+	w_raw(code, code_size);
+	free(code);
+}
+
+void xr_writer::w_compressed_chunks(uint32_t first_id, size_t n,
+		const std::function<void(size_t, xr_writer&)>& write)
+{
+	struct packed_chunk {
+		uint8_t*	code;
+		size_t		size;
+	};
+	std::vector<packed_chunk> chunks(n);
+	xr_parallel_for(n, [&](size_t i) {
+		xr_memory_writer w;
+		write(i, w);
+		xr_lzhuf::compress(chunks[i].code, chunks[i].size, w.data(), w.size());
+	});
+	for (size_t i = 0; i != n; ++i) {
+		w_u32((first_id + uint32_t(i)) | xr_reader::CHUNK_COMPRESSED);
+		w_size_u32(chunks[i].size);
+		w_raw(chunks[i].code, chunks[i].size);
+		free(chunks[i].code);
+	}
+}
+
 void xr_writer::w_sz(const std::string& value)
 {
 	// do not write extra '\0'
@@ -28,11 +28,15 @@ public:
 	void		open_chunk(uint32_t id);
 	void		close_chunk();
 	void		w_raw_chunk(uint32_t id, const void* data, size_t size);
+	void		w_compressed_chunk(uint32_t id, const void* data, size_t size);
+	void		w_compressed_chunks(uint32_t first_id, size_t n,
+					const std::function<void(size_t, xr_writer&)>& write);
 
 	void		w_chunk(uint32_t id, const std::string& s);
 
 	template<typename T> void		w_chunk(uint32_t id, const T& value);
 	template<typename T, typename F> void	w_chunks(const T& container, F write);
+	template<typename T, typename F> void	w_compressed_chunks(const T& container, F write);
 	template<typename T, typename F> void	w_seq(const T& container, F write);
 	template<typename T> void		w_seq(const T& container);
 	template<typename T> void		w_cseq(size_t n, const T values[]);
@@ -94,6 +98,7 @@ public:
 	virtual size_t	tell();
 
 	const uint8_t*	data() const;
+	size_t		size() const;
 
 	bool		save_to(const char* path);
 	bool		save_to(const std::string& path);
@@ -192,7 +197,22 @@ template<typename T, typename F> inline void xr_writer::w_chunks(const T& contai
 	}
 }
 
-inline const uint8_t* xr_memory_writer::data() const { return &m_buffer[0]; }
+// Same layout as w_chunks(), but every element is serialized and LZHUF
+// compressed on its own thread before the chunks are written in order,
+// so write() must be safe to call concurrently for different elements.
+template<typename T, typename F> inline void xr_writer::w_compressed_chunks(const T& container, F write)
+{
+	std::vector<const typename T::value_type*> items;
+	items.reserve(container.size());
+	for (typename T::const_iterator it = container.begin(), end = container.end(); it != end; ++it)
+		items.push_back(&*it);
+	w_compressed_chunks(0, items.size(), [&](size_t i, xr_writer& w) {
+		std::invoke(write, *items[i], w);
+	});
+}
+
+inline const uint8_t* xr_memory_writer::data() const { return m_buffer.data(); }
+inline size_t xr_memory_writer::size() const { return m_buffer.size(); }
 
 } // end of namespace xray_re
 